@@ -20,6 +20,7 @@ connection_pool::connection_pool()
 {
     m_CurConn = 0;
     m_FreeConn = 0;
+    m_MaxConn = 0;
 }
 
 connection_pool::~connection_pool()
@@ -70,7 +71,8 @@ MYSQL *connection_pool::GetConnection()
 {
     MYSQL *con = NULL;
 
-    if (connList.size() == 0)
+    // 连接池没有初始化时直接返回; 连接都被借走时在信号量上等待, 不能按链表是否为空判断
+    if (m_MaxConn == 0)
         return NULL;
 
     // wait空闲连接信号量
@@ -0,0 +1,71 @@
+#include "buffer_pool.h"
+
+buffer_pool::buffer_pool()
+{
+    for (int i = 0; i < CLASS_NUM; i++)
+    {
+        m_free[i] = NULL;
+        m_free_bytes[i] = 0;
+    }
+}
+
+// 进程退出时连接可能还持有缓冲区, 交给系统回收
+buffer_pool::~buffer_pool()
+{
+}
+
+int buffer_pool::size_class(size_t size)
+{
+    int c = 0;
+    size_t s = MIN_SIZE;
+    while (s < size)
+    {
+        s <<= 1;
+        c++;
+    }
+    return c;
+}
+
+char *buffer_pool::alloc(size_t size, size_t *actual)
+{
+    if (size > MAX_SIZE)
+        return NULL;
+
+    int c = size_class(size);
+    *actual = MIN_SIZE << c;
+
+    m_lock[c].lock();
+    free_node *node = m_free[c];
+    if (node)
+    {
+        m_free[c] = node->next;
+        m_free_bytes[c] -= *actual;
+    }
+    m_lock[c].unlock();
+
+    if (node)
+        return (char *)node;
+    return (char *)malloc(*actual);
+}
+
+void buffer_pool::free(char *buf, size_t size)
+{
+    if (!buf)
+        return;
+
+    int c = size_class(size);
+    size = MIN_SIZE << c;
+    m_lock[c].lock();
+    if (m_free_bytes[c] + size <= MAX_FREE_BYTES)
+    {
+        free_node *node = (free_node *)buf;
+        node->next = m_free[c];
+        m_free[c] = node;
+        m_free_bytes[c] += size;
+        buf = NULL;
+    }
+    m_lock[c].unlock();
+
+    if (buf)
+        ::free(buf);
+}
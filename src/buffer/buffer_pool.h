@@ -0,0 +1,46 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include "../lock/locker.h"
+
+// 连接读写缓冲区的池: 大小按2的幂分级(512B到1MB), 每级一个空闲链表.
+// 连接按需取用、扩大时换大一级, 空闲时归还, 归还的缓冲区留在链表中给下一个连接复用;
+// 每级保留的空闲缓冲区总大小有上限, 超出的直接释放
+class buffer_pool
+{
+public:
+    static const size_t MIN_SIZE = 512;
+    static const int CLASS_NUM = 12;
+    static const size_t MAX_SIZE = MIN_SIZE << (CLASS_NUM - 1);
+    static const size_t MAX_FREE_BYTES = 4 * 1024 * 1024;   // 每级最多保留的空闲字节数
+
+    static buffer_pool *get_instance()
+    {
+        static buffer_pool instance;
+        return &instance;
+    }
+
+    // 取一个至少size字节的缓冲区, 实际大小(所在级的大小)写入*actual; size超过MAX_SIZE时返回NULL
+    char *alloc(size_t size, size_t *actual);
+    // 归还alloc得到的缓冲区, size为alloc返回的实际大小
+    void free(char *buf, size_t size);
+
+private:
+    buffer_pool();
+    ~buffer_pool();
+
+    static int size_class(size_t size);
+
+    struct free_node
+    {
+        free_node *next;
+    };
+
+    free_node *m_free[CLASS_NUM];
+    size_t m_free_bytes[CLASS_NUM];
+    locker m_lock[CLASS_NUM];
+};
+
+#endif
@@ -0,0 +1,391 @@
+#include "file_cache.h"
+
+file_cache::file_cache()
+{
+    m_max_bytes = 0;
+    m_max_files = 0;
+    m_map_limit = 0;
+    m_bytes = 0;
+    m_count = 0;
+    m_gen = 0;
+    m_head = m_tail = NULL;
+    m_inotifyfd = -1;
+    m_close_log = 0;
+}
+
+// 进程退出时工作线程可能还在引用缓存项, 映射和fd交给系统回收
+file_cache::~file_cache()
+{
+}
+
+void file_cache::init(size_t max_bytes, int max_files, size_t map_limit, int close_log)
+{
+    m_close_log = close_log;
+    m_map_limit = map_limit;
+    m_max_bytes = max_files > 0 ? max_bytes : 0;
+    m_max_files = max_files;
+    if (m_max_bytes == 0)
+        return;
+
+    m_inotifyfd = inotify_init1(IN_CLOEXEC);
+    if (m_inotifyfd < 0)
+    {
+        // 没有inotify无法知道文件何时变化, 不缓存
+        LOG_ERROR("inotify_init1 failed, errno %d, file cache disabled", errno);
+        m_max_bytes = 0;
+        return;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, watch_thread, this) != 0)
+    {
+        close(m_inotifyfd);
+        m_inotifyfd = -1;
+        m_max_bytes = 0;
+        return;
+    }
+    pthread_detach(tid);
+}
+
+// 取文件状态并检查是否可以发送
+int file_cache::check(const char *path, struct stat *st)
+{
+    if (::stat(path, st) < 0)
+        return FILE_NOT_FOUND;
+    if (!(st->st_mode & S_IROTH))
+        return FILE_FORBIDDEN;
+    if (S_ISDIR(st->st_mode))
+        return FILE_IS_DIR;
+    return FILE_OK;
+}
+
+// 打开并映射文件, 得到一个引用计数为1、不在缓存中的缓存项
+file_entry *file_cache::open_entry(const char *path, int *status)
+{
+    struct stat st;
+    *status = check(path, &st);
+    if (*status != FILE_OK)
+        return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        *status = FILE_ERROR;
+        return NULL;
+    }
+
+    char *addr = NULL;
+    if (st.st_size > 0 && (m_map_limit == 0 || (size_t)st.st_size <= m_map_limit))
+    {
+        addr = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            close(fd);
+            *status = FILE_ERROR;
+            return NULL;
+        }
+    }
+
+    file_entry *entry = new file_entry;
+    entry->path = path;
+    entry->fd = fd;
+    entry->addr = addr;
+    entry->st = st;
+    entry->refs = 1;
+    entry->cached = false;
+    entry->wd = -1;
+    entry->name = NULL;
+    entry->prev = entry->next = NULL;
+
+    *status = FILE_OK;
+    return entry;
+}
+
+void file_cache::destroy(file_entry *entry)
+{
+    if (entry->addr)
+        munmap(entry->addr, entry->st.st_size);
+    close(entry->fd);
+    delete entry;
+}
+
+void file_cache::lru_unlink(file_entry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        m_head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        m_tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+void file_cache::lru_push_front(file_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = m_head;
+    if (m_head)
+        m_head->prev = entry;
+    else
+        m_tail = entry;
+    m_head = entry;
+}
+
+// 从缓存中移除(需持有锁), 没有引用时返回该项由调用者在锁外销毁, 否则由最后一个release销毁
+file_entry *file_cache::remove(file_entry *entry)
+{
+    m_table.erase(entry->path);
+    lru_unlink(entry);
+    entry->cached = false;
+    m_bytes -= cost(entry);
+    m_count--;
+    return entry->refs == 0 ? entry : NULL;
+}
+
+// 监视文件所在目录(需持有锁), 同一目录只添加一次
+int file_cache::watch_dir(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    string dir = slash ? string(path, slash == path ? 1 : slash - path) : string(".");
+
+    map<string, int>::iterator it = m_dirs.find(dir);
+    if (it != m_dirs.end())
+        return it->second;
+
+    int wd = inotify_add_watch(m_inotifyfd, dir.c_str(),
+                               IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                               IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd >= 0)
+        m_dirs[dir] = wd;
+    return wd;
+}
+
+int file_cache::acquire(const char *path, file_entry **entry)
+{
+    *entry = NULL;
+    int status;
+
+    // 不缓存
+    if (m_max_bytes == 0)
+    {
+        *entry = open_entry(path, &status);
+        return status;
+    }
+
+    // 命中: 移到LRU表头
+    m_lock.lock();
+    unordered_map<string, file_entry *>::iterator it = m_table.find(path);
+    if (it != m_table.end())
+    {
+        file_entry *hit = it->second;
+        hit->refs++;
+        if (hit != m_head)
+        {
+            lru_unlink(hit);
+            lru_push_front(hit);
+        }
+        m_lock.unlock();
+        *entry = hit;
+        return FILE_OK;
+    }
+
+    // 先监视目录再打开文件, 打开之后的修改一定能收到事件
+    int wd = watch_dir(path);
+    unsigned long gen = m_gen;
+    m_lock.unlock();
+
+    file_entry *fresh = open_entry(path, &status);
+    if (!fresh)
+        return status;
+    *entry = fresh;
+
+    // 映射太大、目录无法监视、打开期间发生过失效时不放入缓存, 本次请求用完即释放
+    if (wd < 0 || cost(fresh) > m_max_bytes / 4)
+        return FILE_OK;
+
+    file_entry *victims = NULL;
+    m_lock.lock();
+    if (gen != m_gen)
+    {
+        m_lock.unlock();
+        return FILE_OK;
+    }
+
+    // 其他线程同时未命中并已放入缓存, 使用已有的
+    it = m_table.find(path);
+    if (it != m_table.end())
+    {
+        file_entry *hit = it->second;
+        hit->refs++;
+        m_lock.unlock();
+        destroy(fresh);
+        *entry = hit;
+        return FILE_OK;
+    }
+
+    // 超出预算时从LRU表尾淘汰; 仍被引用的项先移出缓存, 由最后一个release销毁
+    while (m_tail && (m_bytes + cost(fresh) > m_max_bytes || m_count + 1 > m_max_files))
+    {
+        file_entry *victim = remove(m_tail);
+        if (victim)
+        {
+            victim->next = victims;
+            victims = victim;
+        }
+    }
+
+    fresh->cached = true;
+    fresh->wd = wd;
+    fresh->name = strrchr(fresh->path.c_str(), '/');
+    fresh->name = fresh->name ? fresh->name + 1 : fresh->path.c_str();
+    m_table[fresh->path] = fresh;
+    lru_push_front(fresh);
+    m_bytes += cost(fresh);
+    m_count++;
+    m_lock.unlock();
+
+    while (victims)
+    {
+        file_entry *next = victims->next;
+        destroy(victims);
+        victims = next;
+    }
+    return FILE_OK;
+}
+
+int file_cache::stat(const char *path, struct stat *st)
+{
+    if (m_max_bytes > 0)
+    {
+        m_lock.lock();
+        unordered_map<string, file_entry *>::iterator it = m_table.find(path);
+        if (it != m_table.end())
+        {
+            *st = it->second->st;
+            m_lock.unlock();
+            return FILE_OK;
+        }
+        m_lock.unlock();
+    }
+    return check(path, st);
+}
+
+void file_cache::retain(file_entry *entry)
+{
+    m_lock.lock();
+    entry->refs++;
+    m_lock.unlock();
+}
+
+void file_cache::release(file_entry *entry)
+{
+    if (!entry)
+        return;
+
+    m_lock.lock();
+    bool last = --entry->refs == 0 && !entry->cached;
+    m_lock.unlock();
+
+    if (last)
+        destroy(entry);
+}
+
+void *file_cache::watch_thread(void *arg)
+{
+    ((file_cache *)arg)->watch_loop();
+    return NULL;
+}
+
+// 读取inotify事件, 使对应文件的缓存项失效
+void file_cache::watch_loop()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true)
+    {
+        ssize_t len = read(m_inotifyfd, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            if (len < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (char *p = buf; p < buf + len;)
+        {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+                invalidate(-1, NULL, true);     // 丢了事件, 全部失效
+            else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                invalidate(event->wd, NULL, false);  // 目录本身没了, 目录下的全部失效
+            else if (event->len > 0)
+                invalidate(event->wd, event->name, false);
+        }
+    }
+    LOG_ERROR("inotify read failed, errno %d", errno);
+}
+
+// 文件名相同, 或者一个是另一个的预压缩版本(.gz/.br).
+// 原文件和压缩版本一起失效: 压缩版本出现时原文件的响应要重新选择编码, 原文件修改时旧的压缩版本不能再发送
+static bool same_file(const char *a, const char *b)
+{
+    size_t la = strlen(a), lb = strlen(b);
+    if (la == lb)
+        return strcmp(a, b) == 0;
+    if (la < lb)
+    {
+        const char *t = a;
+        a = b;
+        b = t;
+        size_t tl = la;
+        la = lb;
+        lb = tl;
+    }
+    return la == lb + 3 && strncmp(a, b, lb) == 0 && (strcmp(a + lb, ".gz") == 0 || strcmp(a + lb, ".br") == 0);
+}
+
+// 使wd目录下名为name的缓存项(及其预压缩版本)失效; name为NULL时整个目录失效, all为true时全部失效
+void file_cache::invalidate(int wd, const char *name, bool all)
+{
+    file_entry *victims = NULL;
+
+    m_lock.lock();
+    m_gen++;
+    file_entry *entry = m_head;
+    while (entry)
+    {
+        file_entry *next = entry->next;
+        if (all || (entry->wd == wd && (!name || same_file(entry->name, name))))
+        {
+            if (remove(entry))
+            {
+                entry->next = victims;
+                victims = entry;
+            }
+        }
+        entry = next;
+    }
+
+    // 目录的watch已被内核移除, 之后需要重新添加
+    if (all || !name)
+    {
+        for (map<string, int>::iterator it = m_dirs.begin(); it != m_dirs.end();)
+        {
+            if (all || it->second == wd)
+                m_dirs.erase(it++);
+            else
+                ++it;
+        }
+    }
+    m_lock.unlock();
+
+    while (victims)
+    {
+        file_entry *next = victims->next;
+        destroy(victims);
+        victims = next;
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include "../lock/locker.h"
+#include "../log/log.h"
+
+using namespace std;
+
+// 一个已打开并映射的静态文件, 多个连接共享, 按引用计数释放
+struct file_entry
+{
+    string path;        // 真实路径, 缓存的键
+    int fd;             // 文件保持打开
+    char *addr;         // mmap得到的地址; 空文件和超过映射上限的大文件为NULL, 用fd发送
+    struct stat st;
+
+    int refs;           // 引用计数, 受缓存锁保护
+    std::atomic<bool> cached;   // 是否还在缓存表中; 被淘汰或失效后为false, 最后一个引用释放时销毁; 响应缓存据此判断是否过期
+    int wd;             // 所在目录的inotify watch
+    const char *name;   // path中的文件名部分, 与inotify事件的name比较
+
+    file_entry *prev;   // LRU链表, 表头是最近使用的
+    file_entry *next;
+};
+
+// 进程内共享的静态文件缓存: 按真实路径缓存打开的fd和mmap, 超出内存或文件数预算时按LRU淘汰,
+// 文件所在目录由inotify监视, 文件被修改、删除、改名后对应缓存项失效.
+// 命中时只在锁内查表和调整链表, 不需要任何文件系统调用
+class file_cache
+{
+public:
+    enum FILE_STATUS
+    {
+        FILE_OK = 0,
+        FILE_NOT_FOUND,     // stat失败
+        FILE_FORBIDDEN,     // 其他用户不可读
+        FILE_IS_DIR,        // 是目录
+        FILE_ERROR          // open或mmap失败
+    };
+
+    // 单例
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    // max_bytes为0时不缓存, 每次请求都打开文件(与不使用缓存时一样);
+    // 大于map_limit的文件只打开不映射, 由调用者用sendfile发送, map_limit为0时都映射
+    void init(size_t max_bytes, int max_files, size_t map_limit, int close_log);
+
+    // 取得path对应的文件, 成功时*entry引用计数加一, 用完后调用release
+    int acquire(const char *path, file_entry **entry);
+    void retain(file_entry *entry);     // 已持有引用时再加一个引用
+    void release(file_entry *entry);
+
+    // 只取文件状态, 不打开不映射: 命中时复制缓存项的stat, 未命中时调用stat; 返回值同acquire
+    int stat(const char *path, struct stat *st);
+
+private:
+    file_cache();
+    ~file_cache();
+
+    static int check(const char *path, struct stat *st);
+    file_entry *open_entry(const char *path, int *status);
+    static size_t cost(file_entry *entry) { return entry->addr ? entry->st.st_size : 0; }
+    void destroy(file_entry *entry);
+    void lru_unlink(file_entry *entry);
+    void lru_push_front(file_entry *entry);
+    file_entry *remove(file_entry *entry);
+    int watch_dir(const char *path);
+
+    static void *watch_thread(void *arg);
+    void watch_loop();
+    void invalidate(int wd, const char *name, bool all);
+
+private:
+    size_t m_max_bytes;     // 内存预算, 只计算映射的文件
+    size_t m_map_limit;     // 超过这个大小的文件不映射
+    int m_max_files;        // 打开文件数预算
+    size_t m_bytes;         // 缓存中已映射文件的总大小
+    int m_count;            // 缓存中的文件数
+    unsigned long m_gen;    // 每次失效加一, 未命中时据此判断打开期间文件是否变过
+
+    unordered_map<string, file_entry *> m_table;
+    file_entry *m_head;     // LRU表头, 最近使用
+    file_entry *m_tail;     // LRU表尾, 最先淘汰
+    map<string, int> m_dirs;    // 已监视的目录 -> watch
+
+    int m_inotifyfd;
+    locker m_lock;
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "precompress.h"
+#include <zlib.h>
+#include <brotli/encode.h>
+
+void precompress::start(const char *root, int close_log)
+{
+    precompress *p = new precompress(root, close_log);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, worker, p) != 0)
+    {
+        delete p;
+        return;
+    }
+    pthread_detach(tid);
+}
+
+bool precompress::compressible(const char *path)
+{
+    static const char *exts[] = {".html", ".htm", ".css", ".js", ".json", ".txt", ".xml", ".svg", ".md", NULL};
+
+    const char *dot = strrchr(path, '.');
+    if (!dot || strchr(dot, '/'))
+        return false;
+    for (int i = 0; exts[i]; i++)
+    {
+        if (strcasecmp(dot, exts[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+void *precompress::worker(void *arg)
+{
+    precompress *p = (precompress *)arg;
+    p->walk(p->m_root);
+    int m_close_log = p->m_close_log;
+    LOG_INFO("precompress done, %d files written", p->m_count);
+    delete p;
+    return NULL;
+}
+
+void precompress::walk(const string &dir)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+            continue;
+
+        string path = dir + "/" + ent->d_name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) < 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            walk(path);
+        else if (S_ISREG(st.st_mode) && compressible(path.c_str()))
+            process(path, st);
+    }
+    closedir(d);
+}
+
+// 压缩版本不存在或比原文件旧时重新生成; 压缩后没有变小的不保留
+void precompress::process(const string &path, const struct stat &st)
+{
+    if (st.st_size < MIN_SIZE || st.st_size > MAX_SIZE || !(st.st_mode & S_IROTH))
+        return;
+
+    struct stat gz_st, br_st;
+    string gz_path = path + ".gz";
+    string br_path = path + ".br";
+    bool need_gz = stat(gz_path.c_str(), &gz_st) < 0 || gz_st.st_mtime < st.st_mtime;
+    bool need_br = stat(br_path.c_str(), &br_st) < 0 || br_st.st_mtime < st.st_mtime;
+    if (!need_gz && !need_br)
+        return;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    char *data = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return;
+
+    vector<char> out;
+    if (need_gz && gzip(data, st.st_size, out) && out.size() < (size_t)st.st_size && write_file(gz_path, &out[0], out.size()))
+        m_count++;
+    if (need_br && brotli(data, st.st_size, out) && out.size() < (size_t)st.st_size && write_file(br_path, &out[0], out.size()))
+        m_count++;
+    munmap(data, st.st_size);
+}
+
+bool precompress::write_file(const string &path, const char *data, size_t len)
+{
+    string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG_WARN("precompress: cannot create %s, errno %d", tmp.c_str(), errno);
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = write(fd, data + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+
+    if (done != len || rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool precompress::gzip(const char *data, size_t len, vector<char> &out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits加16输出gzip格式
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out.resize(deflateBound(&zs, len));
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+bool precompress::brotli(const char *data, size_t len, vector<char> &out)
+{
+    size_t out_len = BrotliEncoderMaxCompressedSize(len);
+    if (out_len == 0)
+        return false;
+
+    out.resize(out_len);
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               len, (const uint8_t *)data, &out_len, (uint8_t *)&out[0]))
+        return false;
+    out.resize(out_len);
+    return true;
+}
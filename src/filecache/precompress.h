@@ -0,0 +1,53 @@
+#ifndef PRECOMPRESS_H
+#define PRECOMPRESS_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "../log/log.h"
+
+using namespace std;
+
+// 静态文本文件的预压缩版本: 启动时在后台线程中遍历网站根目录,
+// 为缺少压缩版本或压缩版本比原文件旧的文本文件生成同目录下的 .gz 和 .br 文件,
+// 请求时http_conn按Accept-Encoding直接发送这些文件, 不在请求路径上压缩
+class precompress
+{
+public:
+    static const off_t MIN_SIZE = 256;              // 小于这个大小的文件不压缩
+    static const off_t MAX_SIZE = 16 * 1024 * 1024; // 超过这个大小的文件不压缩
+
+    // 启动后台线程处理root目录, 立即返回
+    static void start(const char *root, int close_log);
+
+    // 按扩展名判断是否是值得压缩的文本文件
+    static bool compressible(const char *path);
+
+private:
+    precompress(const char *root, int close_log) : m_root(root), m_close_log(close_log), m_count(0) {}
+
+    static void *worker(void *arg);
+    void walk(const string &dir);
+    void process(const string &path, const struct stat &st);
+
+    // 压缩结果先写临时文件再改名, 请求不会读到写了一半的文件
+    bool write_file(const string &path, const char *data, size_t len);
+    bool gzip(const char *data, size_t len, vector<char> &out);
+    bool brotli(const char *data, size_t len, vector<char> &out);
+
+private:
+    string m_root;
+    int m_close_log;
+    int m_count;        // 生成的文件数
+};
+
+#endif
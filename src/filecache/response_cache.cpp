@@ -0,0 +1,320 @@
+#include "response_cache.h"
+
+/* ============ 访问频率统计 ============ */
+
+void frequency_sketch::init(size_t width)
+{
+    size_t n = 64;
+    while (n < width)
+        n <<= 1;
+    m_mask = n - 1;
+    m_table.assign(n * 4 / 2, 0);  // 4行, 每字节两个计数器
+    m_additions = 0;
+    m_sample = n * 10;
+}
+
+// 每行用不同的奇数乘子打散哈希, 得到该行的计数器下标
+size_t frequency_sketch::index(uint64_t hash, int row) const
+{
+    static const uint64_t seeds[4] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                                      0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+    uint64_t h = (hash + seeds[row]) * seeds[(row + 1) & 3];
+    h ^= h >> 32;
+    return row * (m_mask + 1) + (h & m_mask);
+}
+
+void frequency_sketch::increment(uint64_t hash)
+{
+    if (m_table.empty())
+        return;
+
+    for (int row = 0; row < 4; row++)
+    {
+        size_t i = index(hash, row);
+        int shift = (i & 1) << 2;
+        uint8_t &b = m_table[i >> 1];
+        if (((b >> shift) & 0xf) < 15)
+            b += 1 << shift;
+    }
+
+    if (++m_additions >= m_sample)
+        reset();
+}
+
+int frequency_sketch::frequency(uint64_t hash) const
+{
+    if (m_table.empty())
+        return 0;
+
+    int freq = 15;
+    for (int row = 0; row < 4; row++)
+    {
+        size_t i = index(hash, row);
+        int count = (m_table[i >> 1] >> ((i & 1) << 2)) & 0xf;
+        if (count < freq)
+            freq = count;
+    }
+    return freq;
+}
+
+// 所有计数器减半
+void frequency_sketch::reset()
+{
+    for (size_t i = 0; i < m_table.size(); i++)
+        m_table[i] = (m_table[i] >> 1) & 0x77;
+    m_additions /= 2;
+}
+
+/* ============ 响应缓存 ============ */
+
+response_cache::response_cache()
+{
+    m_max_bytes = 0;
+    m_max_window = 0;
+    m_max_protected = 0;
+    for (int i = 0; i < REGION_NUM; i++)
+    {
+        m_head[i] = m_tail[i] = NULL;
+        m_bytes[i] = 0;
+    }
+    m_hits = 0;
+    m_misses = 0;
+}
+
+// 与文件缓存一样, 进程退出时交给系统回收
+response_cache::~response_cache()
+{
+}
+
+void response_cache::init(size_t max_bytes)
+{
+    m_max_bytes = max_bytes;
+    if (m_max_bytes == 0)
+        return;
+
+    // 窗口约占1%, 但至少能放下一个最大的响应; 保护区占主区的80%
+    m_max_window = m_max_bytes / 100;
+    if (m_max_window < MAX_ENTRY * 2)
+        m_max_window = MAX_ENTRY * 2;
+    if (m_max_window > m_max_bytes / 2)
+        m_max_window = m_max_bytes / 2;
+    m_max_protected = (m_max_bytes - m_max_window) / 10 * 8;
+
+    // 按平均每个响应2KB估计条目数
+    m_sketch.init(m_max_bytes / 2048);
+}
+
+uint64_t response_cache::hash_key(const string &key)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        h ^= (unsigned char)key[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+string response_cache::make_key(const char *path, int variant)
+{
+    string key(path);
+    key.push_back('\0');
+    key.push_back('0' + variant);
+    return key;
+}
+
+void response_cache::unlink(resp_entry *entry)
+{
+    int r = entry->region;
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        m_head[r] = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        m_tail[r] = entry->prev;
+    entry->prev = entry->next = NULL;
+    m_bytes[r] -= entry->weight;
+}
+
+void response_cache::push_front(resp_entry *entry, int region)
+{
+    entry->region = region;
+    entry->prev = NULL;
+    entry->next = m_head[region];
+    if (m_head[region])
+        m_head[region]->prev = entry;
+    else
+        m_tail[region] = entry;
+    m_head[region] = entry;
+    m_bytes[region] += entry->weight;
+}
+
+// 移出缓存(需持有锁), 没有引用时返回该项由调用者在锁外销毁
+resp_entry *response_cache::remove(resp_entry *entry)
+{
+    m_table.erase(entry->key);
+    unlink(entry);
+    entry->region = -1;
+    return entry->refs == 0 ? entry : NULL;
+}
+
+void response_cache::destroy(resp_entry *entry)
+{
+    free(entry->data);
+    file_cache::get_instance()->release(entry->file);
+    delete entry;
+}
+
+// 窗口超出上限时, 窗口表尾作为候选进入试用区; 主区超出上限时候选与试用区表尾比较频率, 淘汰较低的
+void response_cache::evict(resp_entry *&victims)
+{
+    while (m_bytes[WINDOW] > m_max_window && m_tail[WINDOW])
+    {
+        resp_entry *candidate = m_tail[WINDOW];
+        unlink(candidate);
+        push_front(candidate, PROBATION);
+
+        while (m_bytes[PROBATION] + m_bytes[PROTECTED] > m_max_bytes - m_max_window)
+        {
+            resp_entry *victim = m_tail[PROBATION];
+            if (victim == candidate && m_tail[PROTECTED])
+                victim = m_tail[PROTECTED];
+
+            resp_entry *out = candidate;
+            if (victim != candidate && m_sketch.frequency(candidate->hash) > m_sketch.frequency(victim->hash))
+                out = victim;
+
+            if (remove(out))
+            {
+                out->next = victims;
+                victims = out;
+            }
+            if (out == candidate)
+                break;
+        }
+    }
+}
+
+resp_entry *response_cache::acquire(const char *path, int variant)
+{
+    if (m_max_bytes == 0)
+        return NULL;
+
+    string key = make_key(path, variant);
+    uint64_t hash = hash_key(key);
+    resp_entry *stale = NULL;
+
+    m_lock.lock();
+    m_sketch.increment(hash);
+
+    unordered_map<string, resp_entry *>::iterator it = m_table.find(key);
+    if (it == m_table.end())
+    {
+        m_misses++;
+        m_lock.unlock();
+        return NULL;
+    }
+
+    // 文件变了, 响应随之失效
+    resp_entry *entry = it->second;
+    if (!entry->file->cached)
+    {
+        stale = remove(entry);
+        m_misses++;
+        m_lock.unlock();
+        if (stale)
+            destroy(stale);
+        return NULL;
+    }
+
+    m_hits++;
+    entry->refs++;
+    int region = entry->region;
+    unlink(entry);
+    if (region == PROBATION)
+    {
+        // 试用区再次命中, 升到保护区; 保护区超出上限时表尾降回试用区
+        push_front(entry, PROTECTED);
+        while (m_bytes[PROTECTED] > m_max_protected && m_tail[PROTECTED] != entry)
+        {
+            resp_entry *demoted = m_tail[PROTECTED];
+            unlink(demoted);
+            push_front(demoted, PROBATION);
+        }
+    }
+    else
+        push_front(entry, region);
+    m_lock.unlock();
+    return entry;
+}
+
+void response_cache::release(resp_entry *entry)
+{
+    if (!entry)
+        return;
+
+    m_lock.lock();
+    bool last = --entry->refs == 0 && entry->region == -1;
+    m_lock.unlock();
+
+    if (last)
+        destroy(entry);
+}
+
+void response_cache::insert(const char *path, int variant, const char *header, size_t header_len, file_entry *file)
+{
+    if (m_max_bytes == 0 || !file->addr || !file->cached)
+        return;
+
+    size_t len = header_len + file->st.st_size;
+    if (len > MAX_ENTRY)
+        return;
+
+    resp_entry *entry = new resp_entry;
+    entry->key = make_key(path, variant);
+    entry->hash = hash_key(entry->key);
+    entry->len = len;
+    entry->weight = len + entry->key.size() + sizeof(resp_entry);
+    entry->data = (char *)malloc(len);
+    memcpy(entry->data, header, header_len);
+    memcpy(entry->data + header_len, file->addr, file->st.st_size);
+    entry->refs = 0;
+    entry->region = -1;
+    entry->prev = entry->next = NULL;
+    entry->file = file;
+    file_cache::get_instance()->retain(file);
+
+    resp_entry *victims = NULL;
+    m_lock.lock();
+    if (m_table.count(entry->key))
+    {
+        // 其他线程已经放入
+        m_lock.unlock();
+        destroy(entry);
+        return;
+    }
+    m_table[entry->key] = entry;
+    push_front(entry, WINDOW);
+    evict(victims);
+    m_lock.unlock();
+
+    while (victims)
+    {
+        resp_entry *next = victims->next;
+        destroy(victims);
+        victims = next;
+    }
+}
+
+void response_cache::get_stats(stats &st)
+{
+    m_lock.lock();
+    st.hits = m_hits;
+    st.misses = m_misses;
+    st.entries = m_table.size();
+    st.bytes = m_bytes[WINDOW] + m_bytes[PROBATION] + m_bytes[PROTECTED];
+    m_lock.unlock();
+}
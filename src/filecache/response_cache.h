@@ -0,0 +1,117 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../lock/locker.h"
+#include "file_cache.h"
+
+using namespace std;
+
+// 一个完整的响应(状态行、响应头、文件内容)放在一块连续内存中, 命中时一次send发完
+struct resp_entry
+{
+    string key;         // 文件真实路径 + 响应变体
+    char *data;
+    size_t len;
+    size_t weight;      // 计入内存上限的大小
+    uint64_t hash;      // key的哈希, 查询访问频率用
+    file_entry *file;   // 生成响应的文件, 持有引用; 文件在文件缓存中失效后响应也失效
+
+    int refs;           // 引用计数, 受缓存锁保护
+    int region;         // 所在的区: 窗口、试用、保护, 被移出缓存后为-1
+    resp_entry *prev;
+    resp_entry *next;
+};
+
+// 访问频率的近似统计(Count-Min Sketch): 4行4位计数器, 访问次数达到采样数后全部减半, 让旧的热度逐渐衰减
+class frequency_sketch
+{
+public:
+    frequency_sketch() : m_mask(0), m_additions(0), m_sample(0) {}
+
+    void init(size_t width);
+    void increment(uint64_t hash);
+    int frequency(uint64_t hash) const;
+
+private:
+    size_t index(uint64_t hash, int row) const;
+    void reset();
+
+    vector<uint8_t> m_table;    // 每字节两个4位计数器
+    size_t m_mask;
+    size_t m_additions;
+    size_t m_sample;
+};
+
+// 小文件完整响应缓存, 按W-TinyLFU淘汰:
+// 新响应先进窗口LRU(约1%), 从窗口挤出时与试用区LRU的表尾比较访问频率, 频率高的留下;
+// 试用区再次命中的升到保护区(约占主区80%), 保护区挤出的降回试用区
+class response_cache
+{
+public:
+    static const size_t MAX_ENTRY = 64 * 1024;  // 超过这个大小的响应不缓存
+
+    enum REGION { WINDOW = 0, PROBATION, PROTECTED, REGION_NUM };
+
+    // 命中统计
+    struct stats
+    {
+        long hits;
+        long misses;
+        long entries;
+        size_t bytes;
+    };
+
+    static response_cache *get_instance()
+    {
+        static response_cache instance;
+        return &instance;
+    }
+
+    // max_bytes为0时不缓存
+    void init(size_t max_bytes);
+
+    // 按文件路径和响应变体(长连接与否、接受的压缩编码)查找, 命中时引用计数加一, 用完调用release; 同时记录一次访问
+    resp_entry *acquire(const char *path, int variant);
+    void release(resp_entry *entry);
+
+    // 未命中的请求生成响应后放入缓存: 响应头header + 文件内容; 文件需要在文件缓存中并已映射
+    void insert(const char *path, int variant, const char *header, size_t header_len, file_entry *file);
+
+    void get_stats(stats &st);
+
+private:
+    response_cache();
+    ~response_cache();
+
+    static uint64_t hash_key(const string &key);
+    static string make_key(const char *path, int variant);
+
+    void unlink(resp_entry *entry);
+    void push_front(resp_entry *entry, int region);
+    resp_entry *remove(resp_entry *entry);
+    void evict(resp_entry *&victims);
+    void destroy(resp_entry *entry);
+
+private:
+    size_t m_max_bytes;
+    size_t m_max_window;        // 窗口区上限
+    size_t m_max_protected;     // 保护区上限
+
+    unordered_map<string, resp_entry *> m_table;
+    resp_entry *m_head[REGION_NUM];
+    resp_entry *m_tail[REGION_NUM];
+    size_t m_bytes[REGION_NUM];
+    frequency_sketch m_sketch;
+
+    long m_hits;
+    long m_misses;
+    locker m_lock;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include "http_conn.h"
+#include "../webserver/conn_slab.h"
 #include <mysql/mysql.h>
 #include <fstream>
+#include <ctype.h>
 
 // http响应中的状态信息
 const char *ok_200_title = "OK";
@@ -12,10 +14,39 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *partial_206_title = "Partial Content";
+const char *not_modified_304_title = "Not Modified";
+const char *error_416_title = "Range Not Satisfiable";
 
 locker m_lock; // mutex
 map<string, string> users;
 
+// multipart/byteranges的分隔符序号, 每个响应不同
+static std::atomic<unsigned long long> boundary_seq(0);
+
+// 时间格式化为HTTP日期, 如 Sun, 06 Nov 1994 08:49:37 GMT
+static void http_date(time_t t, char *buf, size_t size)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// 预压缩版本, 按优先顺序
+static const struct
+{
+    int flag;
+    const char *name;
+    const char *suffix;
+} encodings[] = {{http_conn::ENC_BR, "br", ".br"}, {http_conn::ENC_GZIP, "gzip", ".gz"}};
+
+// 由inode、修改时间(纳秒)和大小生成强ETag, 文件被替换或修改后一定不同
+static void make_etag(const struct stat &st, char *buf, size_t size)
+{
+    unsigned long long mtime = (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    snprintf(buf, size, "\"%llx-%llx-%llx\"", (unsigned long long)st.st_ino, mtime, (unsigned long long)st.st_size);
+}
+
 // 载入数据库表的用户名密码数据到内存
 void http_conn::initmysql_result(connection_pool *connPool)
 {
@@ -90,41 +121,51 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode) // 将事件重置为EPOLL
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-// 类共享的 用户数 和 epollfd
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+// 类共享的 用户数
+std::atomic<int> http_conn::m_user_count(0);
+long long http_conn::m_send_budget = 0;
+int http_conn::m_max_read_buf = 64 * 1024;
+int http_conn::m_max_write_buf = 16 * 1024;
+char *http_conn::doc_root = NULL;
+int http_conn::m_TRIGMode = 0;
+int http_conn::m_close_log = 0;
+
+// 释放连接引用的缓冲区和文件; socket由最后一个引用关闭
+void http_conn::close_conn()
+{
+    unmap();
+    release_buffers();
+}
 
-// 关闭连接，关闭一个连接，客户总量减一
-void http_conn::close_conn(bool real_close)
+// 事件循环关闭连接时只取下定时器和epoll注册, 放掉自己的引用; 线程池或io_uring还在使用连接时,
+// 由最后一个使用者先从连接表中去掉连接状态, 再关闭socket: fd关闭前不会被新连接复用, 连接表中的位置不会被覆盖
+void http_conn::release()
 {
-    if (real_close && (m_sockfd != -1))
-    {
-        printf("close %d\n", m_sockfd);
-        removefd(m_epollfd, m_sockfd); // epoll 不再监听这个socket的事件
-        m_sockfd = -1;
-        m_user_count--;
-    }
+    if (m_refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    // 归还slab后对象可能马上被其他事件循环的新连接取走, 之后只用局部变量
+    int sockfd = m_sockfd;
+    conn_slab::get_instance()->free(sockfd);
+    close(sockfd);
 }
 
 // 初始化连接, 外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMode,
-                     int close_log, string user, string passwd, string sqlname)
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd)
 {
+    // 超时关闭的连接可能还引用着发送到一半的文件
+    unmap();
+
     m_sockfd = sockfd;
     m_address = addr;
+    m_epollfd = epollfd;
+    m_refs.store(1, std::memory_order_relaxed);     // 事件循环的引用
 
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    // epollfd为-1时连接由io_uring驱动, 不注册epoll
+    if (m_epollfd != -1)
+        addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
 
-    // 当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
-    doc_root = root;
-    m_TRIGMode = TRIGMode;
-    m_close_log = close_log;
-
-    strcpy(sql_user, user.c_str());
-    strcpy(sql_passwd, passwd.c_str());
-    strcpy(sql_name, sqlname.c_str());
-
     init();
 }
 
@@ -132,48 +173,44 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 // check_state 默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
-    bytes_to_send = 0;
-    bytes_have_send = 0;
-    m_check_state = CHECK_STATE_REQUESTLINE;
-    m_linger = false;
-    m_method = GET;
-    m_url = 0;
-    m_version = 0;
-    m_content_length = 0;
-    m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
+    reset_head();
+    m_encoding = NULL;
+    m_vary = false;
     m_read_idx = 0;
     m_write_idx = 0;
-    cgi = 0;
+    m_header_idx = 0;
+    m_keep_alive = false;
+    m_send_queue.clear();
+    m_send_head = 0;
+    m_part_buf.clear();
+    bytes_to_send = 0;
     m_state = 0;
+    m_lane = LANE_STATIC;
     timer_flag = 0;
-    improv = 0;
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
+    release_buffers();
     memset(m_real_file, '\0', FILENAME_LEN);
 }
 
 // 线程run()中运行的
 void http_conn::process()
 {
-    // 解析本地读缓存区中的数据
-    HTTP_CODE read_ret = process_read();
+    // 解析本地读缓存区中的数据, 生成响应报文到本地缓冲区，取得要发送的文件
+    int ret = process_requests();
 
-    // NO_REQUEST，表示请求不完整，需要继续接收请求数据
-    if (read_ret == NO_REQUEST)
+    // 0，表示请求不完整，需要继续接收请求数据
+    if (ret == 0)
     {
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         return;
     }
 
-    // 生成响应报文到本地缓冲区，创建文件的内存映射
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
+    // 需要关闭: 连接归事件循环管理, 这里只shutdown, 重新注册后事件循环收到挂断事件, 取下定时器并关闭
+    if (ret < 0)
     {
-        close_conn();
+        shutdown(m_sockfd, SHUT_RDWR);
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        return;
     }
 
     // 当socket的写缓冲区从不可写变为可写，触发epollout
@@ -182,10 +219,11 @@ void http_conn::process()
 }
 
 // 循环读取客户数据, socket读缓冲 >> 本地读缓冲，直到无数据可读或对方关闭连接
+// 读缓冲末尾总是留一个字节, 解析请求体时要在其后写'\0'
 bool http_conn::read_once()
 {
-    // 本地读缓冲放不下了
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    // 本地读缓冲放满了, 扩大; 已到上限则放不下了
+    if (m_read_idx + 1 >= m_read_size && !grow_read())
     {
         return false;
     }
@@ -194,7 +232,7 @@ bool http_conn::read_once()
     // LT读取数据
     if (0 == m_TRIGMode)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
         m_read_idx += bytes_read;
 
         if (bytes_read <= 0)
@@ -209,7 +247,14 @@ bool http_conn::read_once()
     {
         while (true)
         {
-            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+            if (m_read_idx + 1 >= m_read_size && !grow_read())
+            {
+                // 先解析已读到的数据, 按片段处理的请求体处理后会腾出空间, 剩下的等重新注册后再读;
+                // 腾不出空间时下次进入read_once由开头的检查关闭连接
+                break;
+            }
+
+            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
             if (bytes_read == -1)
             {
                 // 数据读完了，返回-1 非阻塞的 errno 会被置为 EAGAIN or EWOULDBLOCK
@@ -229,237 +274,280 @@ bool http_conn::read_once()
 }
 
 
-/* =============== 解析报文相关 ================ */
-
-// 从状态机，用于读取buffer中一行的内容，并把行之间的'\r''\n'换为'\0''\0'
-// 返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
-http_conn::LINE_STATUS http_conn::parse_line()
+// io_uring后端: 多路recv收到的数据追加到本地读缓冲, 放不下则返回false
+bool http_conn::read_from(const char *buf, int len)
 {
-    char temp;
-    // 循环读到行尾或buffer末端
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    while (m_read_idx + len + 1 > m_read_size)
     {
-
-        // 逐个char分析，temp为将要分析的字节
-        temp = m_read_buf[m_checked_idx];
-
-        // 当前字符为 '\r'
-        if (temp == '\r')
-        {
-            if ((m_checked_idx + 1) == m_read_idx) // '\r'已到达buffer末尾，说明下一个字符'\n'还没被接收，即接受不完整
-                return LINE_OPEN;
-            else if (m_read_buf[m_checked_idx + 1] == '\n') // 下一个字符为'\n'，说明读到行尾
-            {
-                // 每行之间的'\r','\n' 换成 '\0','\0' ，方便后续操作
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            // 除上面外都是格式不对
-            return LINE_BAD;
-        }
-        // 当前字符为 '\n'
-        else if (temp == '\n')
-        {
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r') // 前一个字符为'\r'，说明读到行尾
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
+        if (!grow_read())
+            return false;
     }
 
-    // 读到buffer末尾也没有找到\r\n，需要继续recv到buffer
-    return LINE_OPEN;
+    memcpy(m_read_buf + m_read_idx, buf, len);
+    m_read_idx += len;
+    return true;
 }
 
-// 主状态机，解析从状态机处理后的buffer中的每一个请求行
-// 返回值为请求的解析状态，有NO_REQUEST,GET_REQUEST，BAD_REQUEST 等
-http_conn::HTTP_CODE http_conn::process_read()
+/* =============== 解析报文相关 ================ */
+
+// 读缓冲中可能有多个请求(流水线): 逐个解析并生成响应, 按顺序排在发送队列中, 一起发送.
+// 短连接的请求、multipart响应(分隔行用连接上唯一的m_part_buf)之后不再继续; 写缓冲余量不够一个响应头,
+// 或已排了MAX_PIPELINE个响应时也先停下, 剩下的请求留在读缓冲中, 等这一批发完再处理
+int http_conn::process_requests()
 {
-    // 初始化从状态机状态、HTTP请求解析结果
-    LINE_STATUS line_status = LINE_OK;
-    HTTP_CODE ret = NO_REQUEST;
-    char *text = 0;
+    HTTP_CODE ret = process_read();
+    if (ret == NO_REQUEST)
+        return 0;
 
-    // while 条件中 || 前面的是针对解析 POST 请求的Content
-    while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK)) 
+    for (int count = 1;; count++)
     {
-        text = get_line(); // { return m_read_buf + m_start_line; }
-                           // m_start_line 是行在buffer中的起始位置，将该位置后面的数据赋给text
-
-        m_start_line = m_checked_idx; // m_checked_idx 在从状态机中会移到每行的行首位置
-
-        LOG_INFO("%s", text); // 日志信息
-
-        // 主状态机的状态转移和运行逻辑
-        switch (m_check_state)  // 初始为CHECK_STATE_REQUESTLINE
-        {
-        case CHECK_STATE_REQUESTLINE:
-        {
-            // 解析请求行
-            ret = parse_request_line(text); 
-            if (ret == BAD_REQUEST)
-                return BAD_REQUEST;
-            break;
-        }
-        case CHECK_STATE_HEADER:
-        {   
-            // 解析请求头
-            ret = parse_headers(text);
-            if (ret == BAD_REQUEST)
-                return BAD_REQUEST;
-            // 完整解析GET请求后，跳转到报文响应函数
-            else if (ret == GET_REQUEST)
-                return do_request();
-
+        if (!process_write(ret))
+            return -1;
+        m_keep_alive = m_linger;
+
+        bool more = m_linger && m_part_buf.empty() && count < MAX_PIPELINE &&
+                    m_max_write_buf - m_write_idx >= MAX_HEADER_SIZE;
+        next_request();
+        if (!more)
             break;
-        }
-        case CHECK_STATE_CONTENT:
-        {
-            // 解析消息体，只有 POST 请求需要
-            ret = parse_content(text);
-
-            // 完整解析POST请求后，跳转到报文响应函数
-            if (ret == GET_REQUEST)
-                return do_request();
 
-            // ret!=GET_REQUEST说明还没全部解析完成
-            // 更新 line_status 为 LINE_OPEN ，还有数据要读，并跳出循环
-            line_status = LINE_OPEN;
+        ret = process_read();
+        if (ret == NO_REQUEST)
             break;
-        }
-        default:
-            return INTERNAL_ERROR;
-        }
     }
-
-    return NO_REQUEST;
+    return 1;
 }
 
-// 解析http请求行，获得请求方法，目标url及http版本号
-http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
-{ // 在HTTP报文中，请求行用来说明请求类型，要访问的资源以及所使用的HTTP版本，其中各个部分之间通过 \t 或 空格 分隔。
+// 请求在读缓冲中结束于m_checked_idx: 没有请求体时是空行之后, 有请求体时是请求体(chunked的尾部字段)之后
+void http_conn::next_request()
+{
+    long end = m_checked_idx;
+    if (m_check_state == CHECK_STATE_CONTENT && m_body_end < m_read_idx)
+        m_read_buf[m_body_end] = m_content_tail;
 
-    m_url = strpbrk(text, " \t"); // strpbrk: 检索字符串 text 中第一个匹配字符串 " \t" 的字符(' ' 或 '\t')的位置
+    // 后续请求的字节移到缓冲区开头
+    if (end > 0)
+        memmove(m_read_buf, m_read_buf + end, m_read_idx - end);
+    m_read_idx -= end;
 
-    // 如果没有空格或\t，则报文格式有误
-    if (!m_url)
+    // 已排队响应引用的文件在发完之前保留
+    if (m_file)
     {
-        return BAD_REQUEST;
+        m_held_files.push_back(m_file);
+        m_file = NULL;
+    }
+    if (m_resp)
+    {
+        m_held_resps.push_back(m_resp);
+        m_resp = NULL;
     }
+    m_header_idx = m_write_idx;
 
-    // 将该位置的' '或'\t'改为\0，用于将前面数据取出
-    *m_url++ = '\0';
+    reset_head();
+    m_encoding = NULL;
+    m_vary = false;
+    memset(m_real_file, '\0', FILENAME_LEN);  // do_request拼接路径时依赖结尾的'\0'
+}
 
-    // 取出数据，并通过与GET和POST比较，以确定请求方式
-    char* method = text;
-    if(strcasecmp(method, "GET")==0)
-        m_method = GET;
-    else if(strcasecmp(method,"POST")==0)
+// 主状态机: 请求行和请求头由parse_head逐行解析(见http_parse.cpp), 请求头结束后按路由处理请求体和请求
+// 返回值为请求的解析状态，有NO_REQUEST,GET_REQUEST，BAD_REQUEST 等
+http_conn::HTTP_CODE http_conn::process_read()
+{
+    HTTP_CODE ret;
+    if (m_check_state != CHECK_STATE_CONTENT)
     {
-        m_method = POST;
-        cgi = 1;
+        ret = parse_head();
+        if (ret != GET_REQUEST)     // 请求头不完整或格式不对
+            return ret;
+
+        LOG_INFO("%s %s", m_method == POST ? "POST" : "GET", m_url); // 日志信息
+
+        // 请求头结束时查路由, 请求体交给路由指定的函数处理
+        m_route = s_router.find(m_method, m_url, strlen(m_url));
+        if (!m_chunked && m_content_length == 0)    // 没有请求体则解析完成, 跳转到报文响应函数
+            return do_request();
+        begin_body();
     }
-    else
-        return BAD_REQUEST;
-    
-    // m_url此时跳过了第一个空格或\t字符，但不知道之后是否还有
-    // 将m_url向后偏移，通过查找，继续跳过空格和\t字符，指向请求资源的第一个字符
-    m_url += strspn(m_url," \t");  // strspn: 检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标
 
-    // 类似上面获取m_url的操作,获取m_version
-    m_version = strpbrk(m_url," \t");
-    if(!m_version)
-        return BAD_REQUEST;
-    *m_version++ = '\0';
-    m_version += strspn(m_version, " \t");
-    // 仅支持HTTP/1.1
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
-        return BAD_REQUEST;
+    // 请求体不按行扫描, 由parse_body按Content-Length或chunked分帧处理; 收完后跳转到报文响应函数, 没收完时等待后续数据
+    ret = parse_body();
+    if (ret == GET_REQUEST)
+        return do_request();
+    return ret;
+}
 
-    
-    // 这里主要是有些报文的请求资源中会带有http:// or https://，这里需要对这种情况进行单独处理
-    // 对请求资源前7个字符进行判断，http
-    if (strncasecmp(m_url, "http://", 7) == 0)
+// 请求头结束, 请求体从m_checked_idx开始
+void http_conn::begin_body()
+{
+    m_check_state = CHECK_STATE_CONTENT;
+    m_body_start = m_body_end = m_checked_idx;
+    m_body_handler = m_route ? m_route->body : &http_conn::discard_body;
+    if (m_chunked)
     {
-        m_url += 7;
-        m_url = strchr(m_url, '/');         // strchr：用于查找字符串中的一个字符，并返回该字符在字符串中第一次出现的位置。
+        m_chunk_state = CHUNK_SIZE;
+        m_body_left = 0;
+        // 同时有Content-Length时按chunked解析, 响应后关闭连接, 以免两者不一致时错位解析后面的请求
+        if (header(http_header::CONTENT_LENGTH))
+            m_linger = false;
     }
-    // 对请求资源前8个字符进行判断，https
-    if (strncasecmp(m_url, "https://", 8) == 0)
+    else
+        m_body_left = m_content_length;
+}
+
+// chunk-size [; chunk-ext]: 十六进制的块大小, 扩展忽略; 格式不对时返回-1
+static long parse_chunk_size(const char *text)
+{
+    long size = 0;
+    const char *p = text;
+    for (; isxdigit((unsigned char)*p); p++)
     {
-        m_url += 8;
-        m_url = strchr(m_url, '/');
+        if (size > (LONG_MAX >> 4))
+            return -1;
+        size = size * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (*p | 0x20) - 'a' + 10);
     }
-    
-    //一般的不会带有上述两种符号，直接是单独的/或/后面带访问资源
-    if (!m_url || m_url[0] != '/')
-        return BAD_REQUEST;
-
-    //当url为/时，显示判断界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
-
-    // 状态转移为 CHECK_STATE_HEADER
-    m_check_state = CHECK_STATE_HEADER;
-    
-    return NO_REQUEST;
+    if (p == text)
+        return -1;
+    p += strspn(p, " \t");
+    return (*p == '\0' || *p == ';') ? size : -1;
 }
 
-//解析http请求的一个头部信息
-http_conn::HTTP_CODE http_conn::parse_headers(char *text)
+// 处理读缓冲中已收到的请求体. 收完时返回GET_REQUEST, 收集的请求体在m_string中;
+// 还没收完时删掉已处理的字节, 返回NO_REQUEST等待后续数据
+http_conn::HTTP_CODE http_conn::parse_body()
 {
-    if (text[0] == '\0')    // 当前是空行
+    while (true)
     {
-        if (m_content_length != 0)  // content 有内容，说明是 POST 请求
+        // Content-Length的请求体和块数据: 有多少处理多少
+        if (!m_chunked || m_chunk_state == CHUNK_DATA)
         {
-            m_check_state = CHECK_STATE_CONTENT;
-            return NO_REQUEST;
+            long len = m_read_idx - m_checked_idx;
+            if (len > m_body_left)
+                len = m_body_left;
+            if (len > 0 && !consume_body(len))
+                return BAD_REQUEST;
+            if (m_body_left > 0)
+                break;
+            if (!m_chunked)
+                return end_body();
+            m_chunk_state = CHUNK_DATA_END;
+            continue;
         }
-        return GET_REQUEST;         // content 无内容，说明是 GET 则解析完成
-    }
-    else if (strncasecmp(text, "Connection:", 11) == 0) // connction 字段
-    {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)    // 决定是长连接还是短连接
+
+        // chunked的分帧都是以\r\n结尾的行
+        LINE_STATUS line_status = parse_line();
+        if (line_status == LINE_BAD)
+            return BAD_REQUEST;
+        if (line_status == LINE_OPEN)
+        {
+            if (m_checked_idx - m_start_line > MAX_CHUNK_LINE)
+                return BAD_REQUEST;
+            break;
+        }
+        char *text = get_line();
+        m_start_line = m_checked_idx;
+
+        switch (m_chunk_state)
         {
-            m_linger = true;
+        case CHUNK_SIZE:
+            m_body_left = parse_chunk_size(text);
+            if (m_body_left < 0)
+                return BAD_REQUEST;
+            m_chunk_state = m_body_left ? CHUNK_DATA : CHUNK_TRAILER;
+            break;
+        case CHUNK_DATA_END:
+            if (text[0] != '\0')
+                return BAD_REQUEST;
+            m_chunk_state = CHUNK_SIZE;
+            break;
+        case CHUNK_TRAILER:     // 尾部字段忽略, 空行结束请求体
+            if (text[0] == '\0')
+                return end_body();
+            break;
+        default:
+            return INTERNAL_ERROR;
         }
     }
-    else if (strncasecmp(text, "Content-length:", 15) == 0) // content-length 字段
-    {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
-    }
-    else if (strncasecmp(text, "Host:", 5) == 0)    // host 字段
+
+    compact_body();
+    return NO_REQUEST;
+}
+
+// 请求体片段交给处理函数, 或者接在已收集的请求体后面
+bool http_conn::consume_body(long len)
+{
+    char *data = m_read_buf + m_checked_idx;
+    if (m_body_handler)
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        if (!(this->*m_body_handler)(data, len))
+            return false;
     }
     else
     {
-        LOG_INFO("oop!unknow header: %s", text);    // 其他的放到日志输出
+        if (m_body_end != m_checked_idx)
+            memmove(m_read_buf + m_body_end, data, len);
+        m_body_end += len;
     }
-    return NO_REQUEST;
+    m_body_left -= len;
+    m_checked_idx += len;
+    m_start_line = m_checked_idx;
+
+    return true;
+}
+
+// 请求体收完: 收集的请求体以'\0'结尾放在m_string. 被'\0'覆盖的字节可能是下一个请求的开头, 在next_request中恢复
+http_conn::HTTP_CODE http_conn::end_body()
+{
+    m_content_tail = m_read_buf[m_body_end];
+    m_read_buf[m_body_end] = '\0';
+    m_string = m_read_buf + m_body_start;
+    return GET_REQUEST;
+}
+
+// 请求体中已处理的部分(交给处理函数的数据、chunked的分帧)从读缓冲中删掉, 后面还没解析的数据前移,
+// 读缓冲不随请求体增长
+void http_conn::compact_body()
+{
+    long gap = m_start_line - m_body_end;
+    if (gap <= 0)
+        return;
+    memmove(m_read_buf + m_body_end, m_read_buf + m_start_line, m_read_idx - m_start_line);
+    m_read_idx -= gap;
+    m_checked_idx -= gap;
+    m_start_line -= gap;
+    if (m_colon_idx >= 0)
+        m_colon_idx -= gap;
 }
 
-//判断http请求是否被完整读入
-http_conn::HTTP_CODE http_conn::parse_content(char *text)
+// 通道由路由表决定: 登录、注册要查询或写入数据库, 走CGI通道; 没有路由的请求只读静态文件.
+// 请求行已被解析(等待请求体)时直接用解析结果, 否则在读缓冲里找请求行的方法和url; 请求行还不完整时按静态请求
+int http_conn::classify()
 {
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    if (m_check_state != CHECK_STATE_REQUESTLINE)
     {
-        text[m_content_length] = '\0';
-        //POST请求中最后为输入的用户名和密码
-        m_string = text;
-        return GET_REQUEST;
+        const route<route_handler, body_handler> *r = s_router.find(m_method, m_url, strlen(m_url));
+        return r ? r->lane : LANE_STATIC;
     }
-    return NO_REQUEST;
+
+    // 请求行还没解析: 直接在缓冲区中取出方法和url查路由
+    const char *text = m_read_buf + m_start_line;
+    const char *end = m_read_buf + m_read_idx;
+    const char *url = http_scan::find_space(text, end);
+    int method;
+    if (url - text == 3 && strncasecmp(text, "GET", 3) == 0)
+        method = GET;
+    else if (url - text == 4 && strncasecmp(text, "POST", 4) == 0)
+        method = POST;
+    else
+        return LANE_STATIC;
+
+    while (url < end && (*url == ' ' || *url == '\t'))
+        url++;
+    const char *url_end = url;
+    while (url_end < end && *url_end != ' ' && *url_end != '\t' && *url_end != '\r' && *url_end != '\n')
+        url_end++;
+
+    const route<route_handler, body_handler> *r = s_router.find(method, url, url_end - url);
+    return r ? r->lane : LANE_STATIC;
 }
 
 /* ============================================ */
@@ -467,168 +555,271 @@ http_conn::HTTP_CODE http_conn::parse_content(char *text)
 //网站根目录，文件夹内存放请求的资源和跳转的html文件
 const char* doc_root="/root/CPP_Projects/webserver/Learn_webserver/root";
 
-// 处理解析内容，设置实际文件路径，创建mmap内存映射；处理cgi
+/* ================= 路由 ================= */
+
+// 路由表: 增加页面或接口只需在这里加一行, 不用改解析和分派的代码.
+// 同一路径的精确路由只能有一条; 请求没有匹配的路由时按url发送静态文件, 请求体丢弃.
+// 请求体列为NULL的路由, 请求体整个收集在读缓冲中(不超过读缓冲上限), 处理函数从m_string读取;
+// 否则请求体按到达的片段交给该函数, 处理过的字节随即从读缓冲删除, 多大的请求体都只占读缓冲大小的内存
+static const int ROUTE_GET = 1 << http_conn::GET;
+static const int ROUTE_POST = 1 << http_conn::POST;
+
+constexpr route<http_conn::route_handler, http_conn::body_handler> http_conn::s_routes[] = {
+    // 方法                     匹配         路径            处理函数                   参数                 通道          请求体
+    {ROUTE_GET | ROUTE_POST, ROUTE_EXACT, "/",            &http_conn::serve_page,   "/judge.html",      LANE_STATIC, &http_conn::discard_body},
+    {ROUTE_GET | ROUTE_POST, ROUTE_EXACT, "/0",           &http_conn::serve_page,   "/register.html",   LANE_STATIC, &http_conn::discard_body},   // 注册页面
+    {ROUTE_GET | ROUTE_POST, ROUTE_EXACT, "/1",           &http_conn::serve_page,   "/log.html",        LANE_STATIC, &http_conn::discard_body},   // 登录页面
+    {ROUTE_POST,             ROUTE_EXACT, "/2CGISQL.cgi", &http_conn::cgi_login,    NULL,               LANE_CGI,    NULL},                       // 登录校验
+    {ROUTE_POST,             ROUTE_EXACT, "/3CGISQL.cgi", &http_conn::cgi_register, NULL,               LANE_CGI,    NULL},                       // 注册
+    {ROUTE_GET | ROUTE_POST, ROUTE_EXACT, "/5",           &http_conn::serve_page,   "/picture.html",    LANE_STATIC, &http_conn::discard_body},   // 图片页面
+    {ROUTE_GET | ROUTE_POST, ROUTE_EXACT, "/6",           &http_conn::serve_page,   "/video.html",      LANE_STATIC, &http_conn::discard_body},   // 视频页面
+    {ROUTE_GET | ROUTE_POST, ROUTE_EXACT, "/7",           &http_conn::serve_page,   "/fans.html",       LANE_STATIC, &http_conn::discard_body},   // 关注页面
+};
+
+constexpr http_router<http_conn::route_handler, http_conn::body_handler> http_conn::s_router(http_conn::s_routes);
+
+// 处理解析后的请求: 有匹配的路由(请求头结束时已查好)时交给它的处理函数, 否则url就是网站目录下的文件
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    
     printf("m_url:%s\n", m_url);
 
-    const char *p = strrchr(m_url, '/');     // 最后一次出现字符 '/' 的位置
+    if (m_route)
+        return (this->*m_route->handler)(m_route->arg);
+    return serve_file(m_url);
+}
 
-    // 处理cgi，登录和注册校验
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
-    {
+http_conn::HTTP_CODE http_conn::serve_page(const char *page)
+{
+    return serve_file(page);
+}
 
-        // 根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
+bool http_conn::discard_body(const char *, int)
+{
+    return true;
+}
 
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
+// 从请求体 user=123&password=123 中取出用户名和密码, 各自最多size - 1个字符
+static void parse_user(const char *body, char *name, char *password, int size)
+{
+    const char *p = strchr(body, '=');
+    p = p ? p + 1 : body + strlen(body);
+    int i = 0;
+    while (*p && *p != '&' && i < size - 1)
+        name[i++] = *p++;
+    name[i] = '\0';
+
+    p = strchr(p, '=');
+    p = p ? p + 1 : "";
+    i = 0;
+    while (*p && i < size - 1)
+        password[i++] = *p++;
+    password[i] = '\0';
+}
 
-        // 将用户名和密码提取出来
-        // user=123 & passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
+//若浏览器端输入的用户名和密码在表中可以查找到, 发送欢迎页, 否则发送登录错误页
+http_conn::HTTP_CODE http_conn::cgi_login(const char *)
+{
+    char name[100], password[100];
+    parse_user(m_string, name, password, sizeof(name));
+
+    m_lock.lock();
+    map<string, string>::iterator it = users.find(name);
+    bool ok = it != users.end() && it->second == password;
+    m_lock.unlock();
+    return serve_file(ok ? "/welcome.html" : "/logError.html");
+}
 
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
+//注册: 先检测数据库中是否有重名的, 没有重名的, 进行增加数据
+http_conn::HTTP_CODE http_conn::cgi_register(const char *)
+{
+    char name[100], password[100];
+    parse_user(m_string, name, password, sizeof(name));
 
-        // 注册
-        if (*(p + 1) == '3')
-        {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
-        {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
-        }
-    }
+    if (users.find(name) != users.end())
+        return serve_file("/registerError.html");
 
+    char sql_insert[256];
+    snprintf(sql_insert, sizeof(sql_insert), "INSERT INTO user(username, passwd) VALUES('%s', '%s')", name, password);
 
-    // 请求资源为 /0 ，表示跳转注册界面
-    if (*(p + 1) == '0')
+    // 只有真正要写库时才从连接池取连接, 查询完立即归还; 静态请求不会碰连接池
+    int res;
     {
-        // 把 "/register.html" 拼接到 m_real_file
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        MYSQL *mysql = NULL;
+        connectionRAII mysqlcon(&mysql, connection_pool::GetInstance());
+        m_lock.lock();
+        res = mysql ? mysql_query(mysql, sql_insert) : 1;
+        users.insert(pair<string, string>(name, password));
+        m_lock.unlock();
     }
-    // 如果请求资源为/1，表示跳转登录界面
-    else if (*(p + 1) == '1')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    return serve_file(res ? "/registerError.html" : "/log.html");
+}
 
-        free(m_url_real);
-    }
-    // 如果请求资源为/5，表示跳转图片界面
-    else if (*(p + 1) == '5')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+// 设置实际文件路径, 从文件缓存取得文件; 条件请求和命中响应缓存时不取文件
+http_conn::HTTP_CODE http_conn::serve_file(const char *path)
+{
+    int len = strlen(doc_root);
+    strcpy(m_real_file, doc_root);
+    strncpy(m_real_file + len, path, FILENAME_LEN - len - 1);
 
-        free(m_url_real);
-    }
-    // 如果请求资源为/6，表示跳转视频界面
-    else if (*(p + 1) == '6')
+    // 文本文件可能有预压缩版本, 响应随Accept-Encoding变化; 只由文件决定, 与请求方法无关:
+    // POST发送的页面(登录结果等)同样放入响应缓存, 之后的GET会命中它, 必须带着同样的Vary
+    m_vary = precompress::compressible(m_real_file);
+
+    // 小文件的完整响应已缓存时, 不需要再选择编码、取文件和生成响应头; Range请求和条件请求不查缓存
+    if (!header(http_header::RANGE) && !header(http_header::IF_NONE_MATCH) && !header(http_header::IF_MODIFIED_SINCE))
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        m_resp = response_cache::get_instance()->acquire(m_real_file, resp_variant());
+        if (m_resp)
+            return FILE_REQUEST;
+    }
 
-        free(m_url_real);
+    // 客户端接受压缩时改为发送预压缩版本
+    char encoded_file[FILENAME_LEN + 4];
+    const char *file = m_vary && m_accept_encoding ? select_encoding(encoded_file) : m_real_file;
+
+    // 条件请求先只取文件状态, 验证器匹配时回复304, 不打开也不映射文件
+    if (m_method == GET && (header(http_header::IF_NONE_MATCH) || header(http_header::IF_MODIFIED_SINCE)))
+    {
+        if (file_cache::get_instance()->stat(file, &m_file_stat) == file_cache::FILE_OK &&
+            m_file_stat.st_size != 0 && not_modified(m_file_stat))
+            return NOT_MODIFIED;
     }
-    // 如果请求资源为/7，表示跳转关注界面
-    else if (*(p + 1) == '7')
+
+    // 从共享的文件缓存取得打开并映射好的文件, 命中时没有文件系统调用
+    switch (file_cache::get_instance()->acquire(file, &m_file))
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    case file_cache::FILE_NOT_FOUND:
+        return NO_RESOURCE;
+    case file_cache::FILE_FORBIDDEN:    // 文件权限不满足
+        return FORBIDDEN_REQUEST;
+    case file_cache::FILE_IS_DIR:       // 文件类型是目录，则返回BAD_REQUEST，表示请求报文有误
+        return BAD_REQUEST;
+    case file_cache::FILE_ERROR:
+        return INTERNAL_ERROR;
+    default:
+        break;
+    }
+
+    // 表示请求文件存在，且可以访问
+    return FILE_REQUEST;
+}
+
+// 按br、gzip的顺序找客户端接受的预压缩版本, 比原文件旧的版本不用(原文件改过但还没重新压缩);
+// 找到时路径写入buf并设置m_encoding, 否则返回原文件路径
+const char *http_conn::select_encoding(char *buf)
+{
+    file_cache *cache = file_cache::get_instance();
+    struct stat st, encoded_st;
+    if (cache->stat(m_real_file, &st) != file_cache::FILE_OK)
+        return m_real_file;
 
-        free(m_url_real);
+    for (size_t i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++)
+    {
+        if (!(m_accept_encoding & encodings[i].flag))
+            continue;
+        snprintf(buf, FILENAME_LEN + 4, "%s%s", m_real_file, encodings[i].suffix);
+        if (cache->stat(buf, &encoded_st) == file_cache::FILE_OK && encoded_st.st_size > 0 &&
+            encoded_st.st_mtime >= st.st_mtime)
+        {
+            m_encoding = encodings[i].name;
+            return buf;
+        }
     }
-    // 如果以上均不符合，即不是登录和注册和其他的，直接将url与网站目录拼接
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+    return m_real_file;
+}
 
+// 读缓冲换大一级, 原有数据复制过去, 指向读缓冲的解析结果随之平移
+bool http_conn::grow_read()
+{
+    long size = m_read_buf ? m_read_size * 2 : READ_BUFFER_INIT;
+    if (size > m_max_read_buf)
+        size = m_max_read_buf;
+    if (size <= m_read_size)
+        return false;
 
-    // 通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体
-    if (stat(m_real_file, &m_file_stat) < 0)
-        return NO_RESOURCE;
+    size_t actual;
+    char *buf = buffer_pool::get_instance()->alloc(size, &actual);
+    if (!buf)
+        return false;
+    if ((long)actual > m_max_read_buf)
+        actual = m_max_read_buf;
 
-    // 文件权限不满足
-    if (!(m_file_stat.st_mode & S_IROTH))
-        return FORBIDDEN_REQUEST;
+    char *old = m_read_buf;
+    if (old)
+    {
+        memcpy(buf, old, m_read_idx);
+        char **ptrs[] = {&m_url, &m_version, &m_string};
+        for (size_t i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); i++)
+        {
+            if (*ptrs[i] && *ptrs[i] >= old && *ptrs[i] < old + m_read_size)
+                *ptrs[i] = buf + (*ptrs[i] - old);
+        }
+        buffer_pool::get_instance()->free(old, m_read_size);
+    }
+    m_read_buf = buf;
+    m_read_size = actual;
+    return true;
+}
 
-    // 文件类型是目录，则返回BAD_REQUEST，表示请求报文有误
-    if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
+// 写缓冲扩大到至少size字节; 发送队列中指向写缓冲的响应头随之平移
+bool http_conn::grow_write(int size)
+{
+    if (size > m_max_write_buf)
+        return false;
+    if (size < WRITE_BUFFER_INIT)
+        size = WRITE_BUFFER_INIT;
 
-    // 以只读方式获取文件描述符，通过mmap将该文件映射到内存中
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    /*
-        start：映射区的开始地址，设置为0时表示由系统决定映射区的起始地址
-        PROT_READ 表示页内容可以被读取
-        MAP_PRIVATE 建立一个写入时拷贝的私有映射，内存区域的写入不会影响到原文件
-    */
-    
-    // 避免文件描述符的浪费和占用
-    close(fd);
+    size_t actual;
+    char *buf = buffer_pool::get_instance()->alloc(size, &actual);
+    if (!buf)
+        return false;
 
-    // 表示请求文件存在，且可以访问
-    return FILE_REQUEST;
+    char *old = m_write_buf;
+    if (old)
+    {
+        memcpy(buf, old, m_write_idx);
+        for (size_t i = m_send_head; i < m_send_queue.size(); i++)
+        {
+            send_seg &seg = m_send_queue[i];
+            if (seg.base && seg.base >= old && seg.base <= old + m_write_size)
+                seg.base = buf + (seg.base - old);
+        }
+        buffer_pool::get_instance()->free(old, m_write_size);
+    }
+    m_write_buf = buf;
+    m_write_size = actual;
+    return true;
 }
 
-// 解除内存映射
+void http_conn::release_buffers()
+{
+    buffer_pool::get_instance()->free(m_read_buf, m_read_size);
+    m_read_buf = NULL;
+    m_read_size = 0;
+    buffer_pool::get_instance()->free(m_write_buf, m_write_size);
+    m_write_buf = NULL;
+    m_write_size = 0;
+}
+
+// 释放对缓存文件和缓存响应的引用, 映射由文件缓存统一管理
 void http_conn::unmap()
 {
-    if (m_file_address)
+    for (size_t i = 0; i < m_held_files.size(); i++)
+        file_cache::get_instance()->release(m_held_files[i]);
+    m_held_files.clear();
+    for (size_t i = 0; i < m_held_resps.size(); i++)
+        response_cache::get_instance()->release(m_held_resps[i]);
+    m_held_resps.clear();
+
+    if (m_file)
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        file_cache::get_instance()->release(m_file);
+        m_file = NULL;
+    }
+    if (m_resp)
+    {
+        response_cache::get_instance()->release(m_resp);
+        m_resp = NULL;
     }
 }
 
@@ -668,71 +859,369 @@ bool http_conn::process_write(HTTP_CODE ret)
     }
     case FILE_REQUEST: // 文件存在，200
     {
-        add_status_line(200, ok_200_title);
+        // 命中响应缓存: 整个响应在一块内存中, 一次发送
+        if (m_resp)
+        {
+            queue_mem(m_resp->data, m_resp->len);
+            return true;
+        }
 
         // 如果请求的资源大小不为0，即文件存在，则要返回 响应报文头部信息 + 响应内容即文件内容
-        if (m_file_stat.st_size != 0)
+        if (m_file->st.st_size != 0)
         {
-            add_headers(m_file_stat.st_size);
+            // 带Range的GET请求: 只发送请求的范围
+            if (header(http_header::RANGE) && m_method == GET && if_range_match())
+            {
+                byte_range ranges[MAX_RANGES];
+                int count = parse_range(m_file->st.st_size, ranges);
+                if (count < 0)
+                {
+                    // 没有一个范围在文件内
+                    add_status_line(416, error_416_title);
+                    add_validators(m_file->st);
+                    add_encoding();
+                    add_response("Content-Range:bytes */%lld\r\n", (long long)m_file->st.st_size);
+                    add_headers(0);
+                    break;
+                }
+                if (count > 0)
+                    return add_ranges(count, ranges);
+            }
 
-            m_iv_count = 2;
-            // 第一个iovec指针指向响应报文缓冲区，长度指向m_write_idx
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            // 第二个iovec指针指向mmap返回的文件指针，长度指向文件大小
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
+            add_status_line(200, ok_200_title);
+            add_response("Accept-Ranges:bytes\r\n");
+            add_validators(m_file->st);
+            add_encoding();
+            add_headers(m_file->st.st_size);
 
-            // 发送的全部数据为响应报文头部信息和文件大小
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            // 发送队列: 响应头 + 文件内容; 映射过的文件用writev发送, 大文件没有映射, 用sendfile从fd发送
+            queue_headers();
+            if (m_file->addr)
+                queue_mem(m_file->addr, m_file->st.st_size);
+            else
+                queue_file(m_file->fd, 0, m_file->st.st_size);
 
+            // 小文件的响应放入响应缓存, 之后同样的请求直接发送
+            if (!header(http_header::RANGE))
+                response_cache::get_instance()->insert(m_real_file, resp_variant(), m_write_buf + m_header_idx,
+                                                     m_write_idx - m_header_idx, m_file);
             return true;
         }
         else
         {
+            add_status_line(200, ok_200_title);
             // 如果请求的资源大小为0，则返回空白html文件
             const char *ok_string = "<html><body></body></html>";
             add_headers(strlen(ok_string));
             if (!add_content(ok_string))
                 return false;
+            break;
         }
     }
+    case NOT_MODIFIED: // 客户端缓存的文件仍有效，304，没有响应体
+    {
+        add_status_line(304, not_modified_304_title);
+        add_validators(m_file_stat);
+        add_encoding();
+        if (!add_linger() || !add_blank_line())
+            return false;
+        break;
+    }
     default:
         return false;
     }
     
-    // 除 FILE_REQUEST 状态外，其余状态只申请一个iovec，指向响应报文缓冲区（不需要返回 mmap 文件映射区的内容）
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    // 除 FILE_REQUEST 状态外，其余状态只发送响应报文缓冲区（不需要返回 mmap 文件映射区的内容）
+    queue_headers();
     return true;
 }
 
-// 统一接口：向本地写buffer写入响应行，参数为格式化字符串，供下面的写状态行、写响应头等接口调用
-bool http_conn::add_response(const char *format, ...)
+// If-None-Match中有一个实体标签与文件的ETag相同(弱比较, 忽略W/), 或者为*时, 文件未修改;
+// 没有If-None-Match时按If-Modified-Since比较修改时间
+bool http_conn::not_modified(const struct stat &st)
 {
-    // 如果写入内容超出m_write_buf大小则报错
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
+    const char *if_none_match = header(http_header::IF_NONE_MATCH);
+    if (if_none_match)
+    {
+        char etag[64];
+        make_etag(st, etag, sizeof(etag));
+        size_t etag_len = strlen(etag);
+
+        const char *p = if_none_match;
+        while (*p)
+        {
+            p += strspn(p, " \t,");
+            if (*p == '*')
+                return true;
+            if (strncmp(p, "W/", 2) == 0)
+                p += 2;
+            size_t len = strcspn(p, " \t,");
+            if (len == etag_len && strncmp(p, etag, len) == 0)
+                return true;
+            p += len;
+        }
         return false;
+    }
 
-    // 定义可变参数列表
-    va_list arg_list;
-    // 将变量arg_list初始化为传入参数
-    va_start(arg_list, format);
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(header(http_header::IF_MODIFIED_SINCE), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0')
+        return false;
+    return st.st_mtime <= timegm(&tm);
+}
 
-    // 将数据format从可变参数列表写入缓冲区写，返回写入数据的长度
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
+// If-Range与文件当前的ETag(强比较)或Last-Modified相同时才按Range响应, 否则发送整个文件; 没有If-Range时总是满足
+bool http_conn::if_range_match()
+{
+    const char *if_range = header(http_header::IF_RANGE);
+    if (!if_range)
+        return true;
+
+    char validator[64];
+    if (if_range[0] == '"')
+        make_etag(m_file->st, validator, sizeof(validator));
+    else
+        http_date(m_file->st.st_mtime, validator, sizeof(validator));
+    return strcmp(if_range, validator) == 0;
+}
 
-    // 如果写入的数据长度超过缓冲区剩余空间，则报错
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+// 解析 Range: bytes=0-499, 500-, -200 这样的字段, 范围截断到文件大小内.
+// 返回范围数; 返回0表示忽略Range发送整个文件(语法错误、范围太多、范围重叠使响应比文件还大);
+// 返回-1表示语法正确但没有一个范围在文件内
+int http_conn::parse_range(off_t size, byte_range *ranges)
+{
+    const char *p = header(http_header::RANGE);
+    if (strncasecmp(p, "bytes=", 6) != 0)
+        return 0;
+    p += 6;
+
+    int count = 0;
+    long long total = 0;
+    while (true)
     {
-        va_end(arg_list);   // 清空可变参数列表
+        p += strspn(p, " \t");
+        char *end;
+        long long first, last;
+        if (*p == '-')
+        {
+            // 最后n个字节
+            p++;
+            if (*p < '0' || *p > '9')
+                return 0;
+            long long suffix = strtoll(p, &end, 10);
+            p = end;
+            first = suffix < size ? size - suffix : 0;
+            last = suffix > 0 ? size - 1 : -1;
+        }
+        else if (*p >= '0' && *p <= '9')
+        {
+            first = strtoll(p, &end, 10);
+            p = end;
+            if (*p++ != '-')
+                return 0;
+            p += strspn(p, " \t");
+            last = size - 1;
+            if (*p >= '0' && *p <= '9')
+            {
+                long long n = strtoll(p, &end, 10);
+                p = end;
+                if (n < first)
+                    return 0;
+                if (n < last)
+                    last = n;
+            }
+        }
+        else
+            return 0;
+
+        // 起点在文件外的范围不满足, 跳过
+        if (first < size && first <= last)
+        {
+            if (count == MAX_RANGES)
+                return 0;
+            ranges[count].first = first;
+            ranges[count].last = last;
+            count++;
+            total += last - first + 1;
+        }
+
+        p += strspn(p, " \t");
+        if (*p == ',')
+            p++;
+        else if (*p == '\0')
+            break;
+        else
+            return 0;
+    }
+
+    if (count == 0)
+        return -1;
+    if (total > size)
+        return 0;
+    return count;
+}
+
+// 文件中的一段: 映射过的用writev发送, 否则用sendfile
+void http_conn::queue_body(off_t offset, size_t len)
+{
+    if (m_file->addr)
+        queue_mem(m_file->addr + offset, len);
+    else
+        queue_file(m_file->fd, offset, len);
+}
+
+// 206响应: 一个范围时用Content-Range直接发送该段;
+// 多个范围时用multipart/byteranges, 各部分的分隔行和头部先全部写入m_part_buf, 再与文件段交替放入发送队列
+bool http_conn::add_ranges(int count, byte_range *ranges)
+{
+    long long size = m_file->st.st_size;
+    add_status_line(206, partial_206_title);
+    add_response("Accept-Ranges:bytes\r\n");
+    add_validators(m_file->st);
+    add_encoding();
+
+    if (count == 1)
+    {
+        long long len = ranges[0].last - ranges[0].first + 1;
+        add_response("Content-Range:bytes %lld-%lld/%lld\r\n", (long long)ranges[0].first, (long long)ranges[0].last, size);
+        if (!add_headers(len))
+            return false;
+        queue_headers();
+        queue_body(ranges[0].first, len);
+        return true;
+    }
+
+    char boundary[32];
+    snprintf(boundary, sizeof(boundary), "%020llu", boundary_seq++);
+
+    // 先生成全部分隔行, 之后不再修改m_part_buf, 队列中的指针保持有效
+    size_t offsets[MAX_RANGES + 1];
+    char part[128];
+    long long len = 0;
+    m_part_buf.clear();
+    for (int i = 0; i < count; i++)
+    {
+        offsets[i] = m_part_buf.size();
+        snprintf(part, sizeof(part), "\r\n--%s\r\nContent-Range:bytes %lld-%lld/%lld\r\n\r\n",
+                 boundary, (long long)ranges[i].first, (long long)ranges[i].last, size);
+        m_part_buf += part;
+        len += ranges[i].last - ranges[i].first + 1;
+    }
+    offsets[count] = m_part_buf.size();
+    snprintf(part, sizeof(part), "\r\n--%s--\r\n", boundary);
+    m_part_buf += part;
+    len += m_part_buf.size();
+
+    add_response("Content-Type:multipart/byteranges; boundary=%s\r\n", boundary);
+    if (!add_headers(len))
         return false;
+
+    queue_headers();
+    for (int i = 0; i < count; i++)
+    {
+        queue_mem(m_part_buf.data() + offsets[i], offsets[i + 1] - offsets[i]);
+        queue_body(ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    queue_mem(m_part_buf.data() + offsets[count], m_part_buf.size() - offsets[count]);
+    return true;
+}
+
+void http_conn::queue_headers()
+{
+    queue_mem(m_write_buf + m_header_idx, m_write_idx - m_header_idx);
+}
+
+void http_conn::queue_mem(const char *base, size_t len)
+{
+    if (len == 0)
+        return;
+    send_seg seg;
+    seg.base = base;
+    seg.fd = -1;
+    seg.offset = 0;
+    seg.len = len;
+    m_send_queue.push_back(seg);
+    bytes_to_send += len;
+}
+
+void http_conn::queue_file(int fd, off_t offset, size_t len)
+{
+    if (len == 0)
+        return;
+    send_seg seg;
+    seg.base = NULL;
+    seg.fd = fd;
+    seg.offset = offset;
+    seg.len = len;
+    m_send_queue.push_back(seg);
+    bytes_to_send += len;
+}
+
+int http_conn::fill_iov(long long budget)
+{
+    m_iv_count = 0;
+    for (size_t i = m_send_head; i < m_send_queue.size() && m_iv_count < IOV_NUM && budget > 0; i++)
+    {
+        const send_seg &seg = m_send_queue[i];
+        if (!seg.base)
+            break;
+        size_t len = (long long)seg.len < budget ? seg.len : (size_t)budget;
+        m_iv[m_iv_count].iov_base = (void *)seg.base;
+        m_iv[m_iv_count].iov_len = len;
+        m_iv_count++;
+        budget -= len;
     }
+    return m_iv_count;
+}
+
+// 短写之后从队首按字节推进, 下一次从准确的位置继续
+void http_conn::consume(size_t bytes)
+{
+    bytes_to_send -= bytes;
+    while (bytes > 0)
+    {
+        send_seg &seg = m_send_queue[m_send_head];
+        size_t n = bytes < seg.len ? bytes : seg.len;
+        if (seg.base)
+            seg.base += n;
+        else
+            seg.offset += n;
+        seg.len -= n;
+        bytes -= n;
+        if (seg.len == 0)
+            m_send_head++;
+    }
+}
+
+// 统一接口：向本地写buffer写入响应行，参数为格式化字符串，供下面的写状态行、写响应头等接口调用
+bool http_conn::add_response(const char *format, ...)
+{
+    // 定义可变参数列表
+    va_list arg_list;
+
+    while (true)
+    {
+        // 将变量arg_list初始化为传入参数
+        va_start(arg_list, format);
+
+        // 将数据format从可变参数列表写入缓冲区写，返回写入数据的长度; 还没有缓冲区时只计算长度
+        int room = m_write_size - m_write_idx;
+        int len = vsnprintf(room > 0 ? m_write_buf + m_write_idx : NULL, room > 0 ? room : 0, format, arg_list);
+        va_end(arg_list);   // 清空可变参数列表
+
+        if (len < 0)
+            return false;
+        if (len < room)
+        {
+            m_write_idx += len;
+            break;
+        }
 
-    m_write_idx += len;
-    va_end(arg_list);
+        // 写不下则扩大写缓冲后重写, 超过上限则报错
+        if (!grow_write(m_write_idx + len + 1))
+            return false;
+    }
 
     LOG_INFO("request:%s", m_write_buf);
 
@@ -746,16 +1235,16 @@ bool http_conn::add_status_line(int status, const char *title)
 }
 
 // 响应头部分：包括content_length, linger, blank_line
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(long long content_len)
 {
     return add_content_length(content_len) && add_linger() &&
            add_blank_line();
 }
 
 // 响应内容长度字段
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(long long content_len)
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    return add_response("Content-Length:%lld\r\n", content_len);
 }
 
 // 添加文本类型，这里是html
@@ -776,6 +1265,23 @@ bool http_conn::add_blank_line()
     return add_response("%s", "\r\n");
 }
 
+// 缓存验证器, 客户端之后用If-None-Match/If-Modified-Since做条件请求
+bool http_conn::add_validators(const struct stat &st)
+{
+    char etag[64], date[64];
+    make_etag(st, etag, sizeof(etag));
+    http_date(st.st_mtime, date, sizeof(date));
+    return add_response("ETag:%s\r\nLast-Modified:%s\r\n", etag, date);
+}
+
+// 发送预压缩版本时的编码, 以及提示缓存按Accept-Encoding区分响应
+bool http_conn::add_encoding()
+{
+    if (m_encoding && !add_response("Content-Encoding:%s\r\n", m_encoding))
+        return false;
+    return !m_vary || add_response("Vary:Accept-Encoding\r\n");
+}
+
 // 添加文本content
 bool http_conn::add_content(const char *content)
 {
@@ -789,42 +1295,77 @@ bool http_conn::add_content(const char *content)
 // 处理好响应内容并设置好本地缓冲区之后，就可以发送给socket，这里使用 iovec + writev 的方法来输出
 // 对标 read_once
 
-// 将响应报文发送给浏览器端
-bool http_conn::write()
+// io_uring后端的process: 只运行状态机, 不操作epoll
+int http_conn::process_uring()
 {
-    int temp = 0;
+    int ret = process_requests();
+    if (ret <= 0)
+        return ret;
 
-    // 若要发送的数据长度为0，表示响应报文为空，一般不会出现这种情况
-    if (bytes_to_send == 0)
-    {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        init();
-        return true;
-    }
+    // io_uring后端的文件都映射在内存中, 发送队列只有内存段
+    return fill_iov(m_send_budget > 0 ? m_send_budget : LLONG_MAX) > 0 ? 1 : -1;
+}
+
+// io_uring后端的write: 事件循环提交的writev完成了bytes字节, 推进发送队列并取出下一批
+int http_conn::write_uring(int bytes)
+{
+    consume(bytes);
+
+    if (bytes_to_send <= 0)
+        return finish_send() ? 0 : -1;
+
+    return fill_iov(m_send_budget > 0 ? m_send_budget : LLONG_MAX) > 0 ? 1 : -1;
+}
 
-    while (1)
+// 将响应报文发送给浏览器端
+// 每次可写事件最多发送m_send_budget字节, 用完后重新注册写事件, 让同一事件循环或工作线程上的其他连接先发送.
+// 重新注册事件后连接可能已被其他线程处理, 调用者不能再访问连接; 读缓冲中的后续请求由*pipelined告知调用者
+bool http_conn::write(bool *pipelined)
+{
+    if (pipelined)
+        *pipelined = false;
+    long long budget = m_send_budget > 0 ? m_send_budget : LLONG_MAX;
+    while (bytes_to_send > 0)
     {
-        // 返回传输的字节数，出错或发完返回-1
-        temp = writev(m_sockfd, m_iv, m_iv_count);
-        
+        if (budget <= 0)
+        {
+            modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+            return true;
+        }
+
+        ssize_t temp;
+        const send_seg &seg = m_send_queue[m_send_head];
+        if (seg.base)
+        {
+            // 合并连续的内存段一起发送; 后面紧跟文件段时用MSG_MORE, 让响应头与文件开头合成满的报文
+            int count = fill_iov(budget);
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_iv;
+            msg.msg_iovlen = count;
+            size_t next = m_send_head + count;
+            bool more = next < m_send_queue.size() && !m_send_queue[next].base;
+            temp = sendmsg(m_sockfd, &msg, more ? MSG_MORE : 0);
+        }
+        else
+        {
+            // 文件内容由内核从页缓存直接发往socket
+            off_t offset = seg.offset;
+            size_t len = (long long)seg.len < budget ? seg.len : (size_t)budget;
+            temp = sendfile(m_sockfd, seg.fd, &offset, len);
+            if (temp == 0)  // 文件被截断, 无法发完
+            {
+                unmap();
+                return false;
+            }
+        }
+
         // 异常终止情况，缓冲区满了 或 出错
         if (temp < 0)
         {
-            // 缓冲区满
-            if (errno == EAGAIN)    
+            // 缓冲区满, 队列记录着准确的位置, 重新注册写事件, 可写时从这里继续
+            if (errno == EAGAIN)
             {
-                // if (bytes_have_send >= m_iv[0].iov_len) // 响应消息已发送完，更新文件内容的iov_base
-                // {
-                //     m_iv[0].iov_len = 0;
-                //     m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-                //     m_iv[1].iov_len = bytes_to_send;
-                // }
-                // else   // 消息体未发送完，更新响应消息体的iov_base
-                // {
-                //     m_iv[0].iov_base = m_write_buf + bytes_have_send;
-                //     m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-                // }
-                // 重新注册写事件
                 modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
                 return true;
             }
@@ -833,40 +1374,51 @@ bool http_conn::write()
             return false;
         }
 
-        // 正常发送则更新相关字节数 和 iov_base
-        bytes_have_send += temp;    // 用来比较和计算偏移
-        bytes_to_send -= temp;
-
-        // 0 是响应消息体，1 是文件的内存映射
-        if (bytes_have_send >= m_iv[0].iov_len) // 响应消息已发送完，更新文件内容的iov_base
-        {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else   // 消息体未发送完，更新响应消息体的iov_base
-        {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-        }
+        consume(temp);
+        budget -= temp;
+    }
 
-        // 数据正常发送完毕后，关闭内存映射区，重置连接对象
-        if (bytes_to_send <= 0)
-        {
-            unmap();
-            // 写完了，下一次操作是读，注册读事件（读取新的http请求或socket连接关闭的消息）
+    // 数据正常发送完毕后，释放文件，清空发送队列
+    if (finish_send())    // 长连接
+    {
+        // 先重置再注册读事件（读取新的http请求或socket连接关闭的消息），
+        // 否则Reactor模式下别的工作线程可能已经在读下一个请求
+        // 短连接不再注册, 以免关闭前又被分发新的事件.
+        // 读缓冲中还有已收到的请求时不注册, 由调用者交给process处理, 处理完再注册读写事件
+        bool more = buffered();
+        if (pipelined)
+            *pipelined = more;
+        if (!more)
             modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        return true;
+    }
+    else             // 短链接则准备关闭连接
+    {
+        return false;
+    }
+}
 
-            if (m_linger)    // 长连接对连接对象进行重置
-            {
-                init();
-                return true;
-            }
-            else             // 短链接则准备关闭连接
-            {
-                return false;
-            }
-        }
+// 解析状态在排队时已经重置, 读缓冲中留着后续请求的字节, 这里只清空发送相关的状态
+bool http_conn::finish_send()
+{
+    unmap();
+    m_send_queue.clear();
+    m_send_head = 0;
+    bytes_to_send = 0;
+    m_write_idx = 0;
+    m_header_idx = 0;
+    m_part_buf.clear();
+
+    // 空闲连接不占缓冲区: 写缓冲总是归还, 读缓冲没有剩余数据时归还
+    buffer_pool::get_instance()->free(m_write_buf, m_write_size);
+    m_write_buf = NULL;
+    m_write_size = 0;
+    if (m_read_idx == 0)
+    {
+        buffer_pool::get_instance()->free(m_read_buf, m_read_size);
+        m_read_buf = NULL;
+        m_read_size = 0;
     }
+    return m_keep_alive;
 }
 
@@ -20,21 +20,73 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <time.h>
 #include <map>
+#include <vector>
+#include <climits>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../filecache/file_cache.h"
+#include "../filecache/response_cache.h"
+#include "../filecache/precompress.h"
+#include "../buffer/buffer_pool.h"
+#include "http_scan.h"
+#include "http_header.h"
+#include "http_router.h"
 
 using namespace std;
 
+template <typename T>
+class done_queue;
+
+// 发送队列中的一段: 内存块(响应头、映射的文件等), 或者用sendfile发送的文件区间
+struct send_seg
+{
+    const char *base;   // 内存段当前的起始地址, 文件段为NULL
+    int fd;             // 文件段的fd
+    off_t offset;       // 文件段当前的偏移
+    size_t len;         // 剩余字节数
+};
+
+// 读缓冲中的一段: 请求头的字段名或值, 不拷贝
+struct header_view
+{
+    unsigned off;
+    unsigned len;
+};
+
+// 请求头索引中的一项; 值已去掉开头的空白, 行尾已换成'\0'
+struct header_field
+{
+    header_view name;
+    header_view value;
+};
+
+// Range请求中的一个字节范围, 闭区间
+struct byte_range
+{
+    off_t first;
+    off_t last;
+};
+
 class http_conn
 {
 public:
     static const int FILENAME_LEN = 200;
-    static const int READ_BUFFER_SIZE = 2048;
-    static const int WRITE_BUFFER_SIZE = 1024;
+    static const int READ_BUFFER_INIT = 1024;   // 读缓冲第一次分配的大小, 放满后加倍直到m_max_read_buf
+    static const int WRITE_BUFFER_INIT = 512;   // 写缓冲第一次分配的大小, 写不下时加倍直到m_max_write_buf
+    static const int SENDFILE_THRESHOLD = 1024 * 1024;  // 超过这个大小的文件不映射, 用sendfile发送
+    static const int IOV_NUM = 16;                      // 一次writev最多合并的内存段
+    static const int MAX_RANGES = 16;                   // Range请求最多响应的范围数, 超过时发送整个文件
+    static const int MAX_PIPELINE = 16;                 // 流水线请求一次最多排队的响应数
+    static const int MAX_HEADER_SIZE = 384;             // 一个响应的状态行和头部最多占用的写缓冲
+    static const int MAX_HEADERS = 32;                  // 请求头索引最多记录的字段数, 超出的照常解析但不记录
+    static const int MAX_CHUNK_LINE = 1024;             // chunked请求体中块大小行、尾部字段行的最大长度
 
     // http请求类型,只实现了get和post
     enum METHOD {
@@ -48,6 +100,14 @@ public:
         CHECK_STATE_CONTENT
     };
 
+    // chunked请求体的解析状态
+    enum CHUNK_STATE {
+        CHUNK_SIZE = 0,     // 块大小所在的行
+        CHUNK_DATA,         // 块数据
+        CHUNK_DATA_END,     // 块数据后面的\r\n
+        CHUNK_TRAILER       // 最后一块之后的尾部字段, 到空行结束
+    };
+
     // 从状态机状态
     enum LINE_STATUS {
         LINE_OK =0,
@@ -55,6 +115,20 @@ public:
         LINE_OPEN
     };
 
+    // 请求在线程池中的通道: 静态文件, CGI(登录注册, 要查询数据库), Reactor模式的写
+    enum LANE {
+        LANE_STATIC = 0,
+        LANE_CGI,
+        LANE_WRITE,
+        LANE_NUM
+    };
+
+    // 客户端接受的预压缩编码
+    enum ENCODING {
+        ENC_GZIP = 1,
+        ENC_BR = 2
+    };
+
     // 请求的解析状态码
     enum HTTP_CODE {
         NO_REQUEST,
@@ -63,101 +137,205 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        NOT_MODIFIED,       // 条件请求的验证器匹配, 回复304
         INTERNAL_ERROR,
         CLOSED_CONNECTION
     };
 
 public:
-    static int m_epollfd;   // epoll对应的fd
-    static int m_user_count; // 总连接数
-    MYSQL* mysql;
-    int m_state;    // 读0，写1
+    static std::atomic<int> m_user_count; // 总连接数, 多个事件循环和工作线程都会修改
+    static long long m_send_budget;       // 每次可写事件最多发送的字节数, 0表示不限制
+    static int m_max_read_buf;            // 读缓冲上限: 请求头(含请求体)超过时关闭连接
+    static int m_max_write_buf;           // 写缓冲上限: 一批流水线响应的头部超过时留到下一批
+
+    // 所有连接相同的配置, 启动时设置一次, 不在每个连接中保存
+    static char *doc_root;      // 网站根目录
+    static int m_TRIGMode;      // 连接socket的触发模式
+    static int m_close_log;
+
+    // 线程池调度字段: 事件循环入队时写, 工作线程取出后读写.
+    // 对象按缓存行对齐, 这几个字段单独占一个缓存行, 不与解析发送的字段、也不与相邻连接的字段共享缓存行
+    alignas(64) int m_state;    // 读0，写1，已读好待处理2
+    int m_lane;                 // 所在的线程池通道
+    int timer_flag;             // Reactor模式下工作线程读写失败, 需要主线程关闭连接
+    long long m_queue_time;     // 进入线程池队列的时间(us), 统计排队时间用
+    std::atomic<int> m_refs;    // 引用数: 事件循环在连接关闭前持有一个, 线程池中的每个任务、io_uring在途的writev各持有一个
+    int m_result;               // io_uring后端在线程池中运行状态机的结果, 同process_uring
+    done_queue<http_conn> *m_done_queue;    // io_uring后端: 工作线程处理完后放入所属事件循环的这个完成队列
 
 private:
-    int m_sockfd;   // socket连接
-    sockaddr_in m_address;
-    
-    // 读数据缓冲区，及相关索引
-    char m_read_buf[READ_BUFFER_SIZE];
+    // 热数据: 每次读写事件和每个请求都要访问的字段, 从新的缓存行开始连续存放, 共三个缓存行
+    alignas(64) int m_sockfd;   // socket连接
+    int m_epollfd;              // 所属事件循环的epoll fd
+    CHECK_STATE m_check_state;  // 主状态机状态
+    METHOD m_method;            // 请求类型
+    bool m_linger;
+    bool m_keep_alive;          // 发送队列发完后是否保持连接, 即最后排入的响应的m_linger
+    bool m_vary;                // 文本文件, 响应随Accept-Encoding变化
+    char m_content_tail;        // 请求体后面的一个字节, 解析时被换成'\0', 之后的请求开头要恢复
+    int m_start_line;           // m_read_buf中已经解析的字符个数
+
+    // 读数据缓冲区，及相关索引; 缓冲区从缓冲区池按需取得, 连接空闲时归还
     long m_read_idx;    // 缓冲区中m_read_buf中数据的最后一个字节的下一个位置
     long m_checked_idx; // m_read_buf读取的位置m_checked_idx
-    int m_start_line;   // m_read_buf中已经解析的字符个数
+    long m_read_size;   // 读缓冲大小, 没有缓冲区时为0
+    char *m_read_buf;
 
-    // 写数据缓冲区，及相关索引
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    // 写数据缓冲区，及相关索引; 流水线上的多个响应的头部依次存放, 响应发完后归还缓冲区池
+    char *m_write_buf;
+    int m_write_size;   // 写缓冲大小
     int m_write_idx;    // 指示buffer中数据的长度
+    int m_header_idx;   // 当前响应的头部在buffer中的起始位置
+    int m_iv_count;
 
-    CHECK_STATE m_check_state;  // 主状态机状态
-    METHOD m_method;            // 请求类型
-
-    // 请求解析后得到的数据，对应下面6个变量
-    char m_real_file[FILENAME_LEN];
-    char *m_url;
-    char *m_version;
-    char *m_host;
+    long long bytes_to_send;        // 队列中剩余的字节数
+    size_t m_send_head;             // 第一个未发完的段
+    vector<send_seg> m_send_queue;  // 待发送的响应, 按顺序发送, 连接重置时清空但保留容量
     long m_content_length;
-    bool m_linger;
 
-    char *m_file_address;   // 服务器文件内存映射后得到的内存地址
-    struct stat m_file_stat;
-    struct iovec m_iv[2];   // io向量机制iovec
-    int m_iv_count;
-    int cgi;        //是否启用的POST
-    char *m_string; //存储请求头数据
-    int bytes_to_send;  // 剩余发送字节数
-    int bytes_have_send;// 已发送字节数
+    file_entry *m_file;     // 响应引用的静态文件(共享缓存中的打开文件和内存映射)
+    resp_entry *m_resp;     // 命中响应缓存时引用的完整响应
+    struct iovec m_iv[IOV_NUM];     // 从发送队列取出的一批连续内存段
 
-    char *doc_root;
+    // 路由的处理函数: 请求收完后生成响应; 处理到达的请求体片段
+    typedef HTTP_CODE (http_conn::*route_handler)(const char *arg);
+    typedef bool (http_conn::*body_handler)(const char *data, int len);    // 返回false时按错误请求处理
 
-    map<string,string> m_users;
-    int m_TRIGMode;
-    int m_close_log;
+    // 请求解析后得到的数据, 只在解析和生成响应时访问
+    char *m_url;
+    char *m_version;
+    char *m_string;     // 收集在读缓冲中的请求体, 以'\0'结尾
+    const route<route_handler, body_handler> *m_route;     // 请求头结束时查到的路由, 没有时为NULL
+    body_handler m_body_handler;    // 请求体片段交给它, NULL时收集在读缓冲中
+    bool m_chunked;             // 请求体为chunked编码
+    CHUNK_STATE m_chunk_state;
+    long m_body_left;           // 当前块(或Content-Length的请求体)还没收到的字节数
+    long m_body_start;          // 请求体在读缓冲中的开始位置
+    long m_body_end;            // 收集在读缓冲中的请求体的结尾, 按片段处理时等于m_body_start
+    int cgi;        //是否启用的POST
+    int m_accept_encoding;      // Accept-Encoding中接受的ENCODING
+    const char *m_encoding;     // 发送的预压缩版本的编码名, 发送原文件时为NULL
+    int m_colon_idx;            // 当前行中第一个':'的位置, 扫描行尾时一起找到, 没有时为-1
+    unsigned m_known_mask;      // 出现过的已知字段, 第HEADER_ID位
+    header_view m_known[http_header::HEADER_COUNT];    // 已知字段的值, 按HEADER_ID; 重复出现时取最后一个
+    int m_header_count;
+    header_field m_headers[MAX_HEADERS];    // 所有字段的索引, 按出现顺序
+    char m_real_file[FILENAME_LEN];
+    struct stat m_file_stat;    // 条件请求时取得的文件状态, 回复304时生成验证器
+    string m_part_buf;              // multipart/byteranges响应中各部分的分隔行和头部
 
-    // mysql连接相关
-    char sql_user[100];
-    char sql_passwd[100];
-    char sql_name[100];
+    // 冷数据: 只在流水线、写日志时访问
+    vector<file_entry *> m_held_files;  // 排在发送队列中的前面几个响应引用的文件, 发完后释放
+    vector<resp_entry *> m_held_resps;
+    sockaddr_in m_address;
 
 public:
-    http_conn();
-    ~http_conn();
+    http_conn() : m_read_size(0), m_read_buf(NULL), m_write_buf(NULL), m_write_size(0), m_file(NULL), m_resp(NULL) {}
+    ~http_conn() {}
 
-    void init(int sockfd, const sockaddr_in&addr, char *, int, int, string user, string passwd, string sqlname);    // 设置sockfd和数据库账号
-    void close_conn(bool real_close = true);    // 关闭sock连接
+    void init(int sockfd, const sockaddr_in&addr, int epollfd);    // 设置sockfd
+    void close_conn();  // 释放连接引用的缓冲区和文件, 连接状态归还slab时调用
+    void hold() { m_refs.fetch_add(1, std::memory_order_relaxed); }
+    void release();     // 放掉一个引用; 最后一个引用从连接表中去掉连接状态并关闭socket
     void process();     // 
     bool read_once();   // 非阻塞读取socket中的数据，放到对象的数据成员中
-    bool write();       // 将对象生成的响应数据发送到socket缓冲区
+    bool write(bool *pipelined = NULL);    // 将对象生成的响应数据发送到socket缓冲区; pipelined: 发完后读缓冲中还有请求, 由调用者处理
+
+    // io_uring后端: 数据由事件循环收好后交给状态机, 响应由事件循环提交writev
+    bool read_from(const char *buf, int len);   // 收到的数据追加到读缓冲
+    int process_uring();                        // 0 请求不完整, 1 响应已就绪, -1 需要关闭
+    int write_uring(int bytes);                 // writev完成bytes字节: 1 还要继续发, 0 长连接已重置, -1 需要关闭
+                                                // 返回1时get_iv()是下一批要提交的内存段
+    struct iovec *get_iv() { return m_iv; }
+    int get_iv_count() { return m_iv_count; }
+
+    // 按请求行分类, 决定请求进线程池的哪个通道; 只读取缓冲区, 不改变解析状态
+    int classify();
+
+    // 长连接的响应已全部发完, 读缓冲中还有已收到的后续请求(流水线), 需要再交给process处理, 不用等读事件;
+    // 响应还没发完(用完发送配额或socket缓冲区满)时为false
+    bool buffered() { return bytes_to_send == 0 && m_read_idx > 0; }
 
     sockaddr_in *get_address() {return &m_address;}
-    void initmysql_result(connection_pool *connPool);
+    int get_sockfd() { return m_sockfd; }
+
+    // 当前请求的字段值, 没有时为NULL; 已知字段按HEADER_ID直接取, 其他按名字在索引中查找.
+    // 值指向读缓冲, 在生成响应之前有效
+    const char *header(int id) const
+    {
+        return (m_known_mask >> id) & 1 ? m_read_buf + m_known[id].off : NULL;
+    }
+    const char *header(const char *name) const;
+    static void initmysql_result(connection_pool *connPool);
 
-    int timer_flag;
-    int improv;
+    // 解析读缓冲中的请求行和请求头, 到空行为止, 不处理请求体、不生成响应:
+    // GET_REQUEST 请求头已完整, NO_REQUEST 还没收完, BAD_REQUEST 格式不对
+    HTTP_CODE parse_head();
+    // 基准测试用: 以buf为读缓冲(大小size, 已有len字节的报文), 解析状态回到请求开始, 之后用parse_head解析
+    void bench_head(char *buf, long size, long len);
 
 private:
     void init(); // 设置sockfd等
 
-    // 解析请求相关
+    // 解析请求相关; 请求头的解析在http_parse.cpp中
     HTTP_CODE process_read();           // 解析本地读缓存区中的数据
-    HTTP_CODE parse_request_line(char* text);
-    HTTP_CODE parse_headers(char *text);
-    HTTP_CODE parse_content(char *text);
+    void reset_head();                  // 解析状态回到请求开始
+    HTTP_CODE parse_request_line(char *text, char *end);   // end为行尾, 即原来'\r'的位置
+    HTTP_CODE parse_headers(char *text, char *end);     // 空行时返回GET_REQUEST
+    void begin_body();                  // 请求头结束, 开始接收请求体
+    HTTP_CODE parse_body();             // 按Content-Length或chunked分帧, 把收到的请求体交给处理函数
+    bool consume_body(long len);        // 从m_checked_idx开始的len字节请求体
+    void compact_body();                // 删掉读缓冲中已处理的请求体和分帧
+    HTTP_CODE end_body();               // 请求体收完
     char *get_line() { return m_read_buf + m_start_line; };
     LINE_STATUS parse_line();
+    int process_requests();     // 处理读缓冲中所有完整的请求: 0 第一个请求不完整, 1 响应已排队, -1 出错
+    void next_request();        // 当前请求的响应已排队, 丢掉它的字节并重置解析状态
 
     void unmap();
 
+    // 读写缓冲相关
+    bool grow_read();                   // 读缓冲放满时换大一级, 已到上限返回false
+    bool grow_write(int size);          // 写缓冲扩大到至少size字节
+    void release_buffers();             // 缓冲区归还缓冲区池
+    const char *select_encoding(char *buf);     // 选择预压缩版本, 返回要发送的文件路径
+    int resp_variant() { return m_linger | (m_vary ? m_accept_encoding << 1 : 0); }  // 响应缓存中的变体
+
+    // 发送队列相关
+    void queue_mem(const char *base, size_t len);           // 追加内存段
+    void queue_file(int fd, off_t offset, size_t len);      // 追加用sendfile发送的文件区间
+    int fill_iov(long long budget);     // 从队首取出不超过budget字节的连续内存段放入m_iv, 返回段数
+    void consume(size_t bytes);         // 已发送bytes字节, 推进队首
+    void queue_headers();               // 追加当前响应在写缓冲中的头部
+    bool finish_send();                 // 队列发完, 释放并清空; 返回是否保持连接
+
+    // 路由: 按方法和路径选择处理函数, 路由表在http_conn.cpp中定义, 编译期建好
+    static const route<route_handler, body_handler> s_routes[];
+    static const http_router<route_handler, body_handler> s_router;
+    HTTP_CODE serve_page(const char *page);     // 发送网站目录下的页面page
+    HTTP_CODE cgi_login(const char *arg);       // 登录校验, 按结果发送欢迎页或错误页
+    HTTP_CODE cgi_register(const char *arg);    // 注册, 按结果发送登录页或错误页
+    bool discard_body(const char *data, int len);   // 不需要请求体的请求, 收到就丢弃
+
     // 生成响应相关
-    HTTP_CODE do_request();             // 生成响应报文到本地写缓冲区
+    HTTP_CODE do_request();             // 按路由处理请求, 没有匹配的路由时发送url对应的静态文件
+    HTTP_CODE serve_file(const char *path);     // 取得网站目录下path对应的文件
     bool process_write(HTTP_CODE ret);  // 本地写缓冲区  》》》 socket写缓冲区
+    bool not_modified(const struct stat &st);   // 条件请求的验证器是否匹配
+    bool if_range_match();              // If-Range条件是否满足
+    int parse_range(off_t size, byte_range *ranges);    // 解析Range字段
+    void queue_body(off_t offset, size_t len);          // 追加文件中的一段
+    bool add_ranges(int count, byte_range *ranges);     // 生成206响应
     bool add_response(const char *format, ...);
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
+    bool add_headers(long long content_length);
     bool add_content_type();
-    bool add_content_length(int content_length);
+    bool add_content_length(long long content_length);
     bool add_linger();
     bool add_blank_line();
+    bool add_validators(const struct stat &st);     // ETag和Last-Modified
+    bool add_encoding();                            // Content-Encoding和Vary
 
 };
 
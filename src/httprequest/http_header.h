@@ -0,0 +1,192 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <string.h>
+#include <stdint.h>
+
+// http_header的编译期部分: 字段名表、哈希函数和建表.
+// 放在单独的结构中, 是因为类定义完整之前不能在常量表达式中调用它的成员函数
+struct header_hash
+{
+    static constexpr const char *NAMES[] = {
+        "Host", "Connection", "Keep-Alive", "Content-Length", "Content-Type", "Transfer-Encoding", "Expect",
+        "Range", "If-Range", "If-None-Match", "If-Modified-Since",
+        "Accept", "Accept-Encoding", "Accept-Language", "Cache-Control", "Cookie", "Authorization",
+        "User-Agent", "Referer", "Origin", "Upgrade"};
+
+    static const int COUNT = sizeof(NAMES) / sizeof(NAMES[0]);
+    static const int TABLE_BITS = 6;    // 64个槽
+    static const int TABLE_SIZE = 1 << TABLE_BITS;
+
+    static constexpr int length(const char *s)
+    {
+        int n = 0;
+        while (s[n])
+            n++;
+        return n;
+    }
+
+    static constexpr int min_len()
+    {
+        int m = length(NAMES[0]);
+        for (int i = 1; i < COUNT; i++)
+            m = length(NAMES[i]) < m ? length(NAMES[i]) : m;
+        return m;
+    }
+
+    static constexpr int max_len()
+    {
+        int m = 0;
+        for (int i = 0; i < COUNT; i++)
+            m = length(NAMES[i]) > m ? length(NAMES[i]) : m;
+        return m;
+    }
+
+    // 字母按小写参与哈希; 其他字节或上0x20后可能与字母相同, 由查找时的比较排除
+    static constexpr unsigned hash(unsigned seed, const char *name, int len)
+    {
+        unsigned h = (seed ^ (unsigned)len) * 0x27d4eb2fu;
+        h = (h ^ (unsigned char)(name[0] | 0x20)) * 0x9e3779b1u;
+        h = (h ^ (unsigned char)(name[len >> 1] | 0x20)) * 0x85ebca6bu;
+        h = (h ^ (unsigned char)(name[len - 1] | 0x20)) * 0xc2b2ae35u;
+        return h >> (32 - TABLE_BITS);
+    }
+
+    static const int NAME_SIZE = 24;    // 字段名按8字节比较, 放得下最长的字段名
+
+    struct table
+    {
+        signed char slot[TABLE_SIZE];   // 槽 -> HEADER_ID, 空槽为-1
+        int len[COUNT];
+        char lower[COUNT][NAME_SIZE];   // 小写的字段名
+        char mask[COUNT][NAME_SIZE];    // 字母为0x20, '-'为0: 请求中的字段名或上它后与lower比较
+    };
+
+    // 用seed构造表, 有两个字段名落在同一个槽时返回的表中slot[0]为-2
+    static constexpr table build(unsigned seed)
+    {
+        table t = {};
+        for (int i = 0; i < TABLE_SIZE; i++)
+            t.slot[i] = -1;
+        for (int id = 0; id < COUNT; id++)
+        {
+            t.len[id] = length(NAMES[id]);
+            for (int i = 0; i < t.len[id]; i++)
+            {
+                char c = NAMES[id][i];
+                t.mask[id][i] = c == '-' ? 0 : 0x20;
+                t.lower[id][i] = c | t.mask[id][i];
+            }
+            unsigned s = hash(seed, NAMES[id], t.len[id]);
+            if (t.slot[s] != -1)
+            {
+                t.slot[0] = -2;
+                return t;
+            }
+            t.slot[s] = id;
+        }
+        return t;
+    }
+
+    // 编译期从1开始试, 取第一个没有冲突的seed; 21个字段名放进64个槽, 几百次内就能找到
+    static constexpr unsigned find_seed()
+    {
+        for (unsigned seed = 1; seed < 100000; seed++)
+        {
+            if (build(seed).slot[0] != -2)
+                return seed;
+        }
+        return 0;
+    }
+};
+
+// 已知请求头字段名的完美哈希, 表在编译期生成.
+// 字段名的长度、首尾字节和中间一个字节(按小写)算出哈希, 每个已知字段名落在表中不同的槽;
+// 查找时算一次哈希, 再比较长度, 长度相同才做一次不区分大小写的比较(按8字节一段). 未知字段名多数在长度比较时就被排除
+class http_header
+{
+public:
+    enum HEADER_ID
+    {
+        UNKNOWN = -1,
+        HOST = 0,
+        CONNECTION,
+        KEEP_ALIVE,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        TRANSFER_ENCODING,
+        EXPECT,
+        RANGE,
+        IF_RANGE,
+        IF_NONE_MATCH,
+        IF_MODIFIED_SINCE,
+        ACCEPT,
+        ACCEPT_ENCODING,
+        ACCEPT_LANGUAGE,
+        CACHE_CONTROL,
+        COOKIE,
+        AUTHORIZATION,
+        USER_AGENT,
+        REFERER,
+        ORIGIN,
+        UPGRADE,
+        HEADER_COUNT
+    };
+
+    // 字段名[name, name + len)对应的HEADER_ID, 不是已知字段时返回UNKNOWN
+    static int lookup(const char *name, int len)
+    {
+        if (len < MIN_LEN || len > MAX_LEN)
+            return UNKNOWN;
+        int id = TABLE.slot[header_hash::hash(SEED, name, len)];
+        if (id < 0 || TABLE.len[id] != len || !same_name(name, id, len))
+            return UNKNOWN;
+        return id;
+    }
+
+    static const char *name(int id) { return header_hash::NAMES[id]; }
+
+private:
+    // 不区分大小写比较字段名, 一次比较8个字节(不足8字节的字段名一次4个字节), 首尾两段可以重叠.
+    // 已知字段名只有字母和'-': 字母或上0x20后相等说明是同一个字母的大写或小写, '-'要求完全相同
+    static bool same_name(const char *name, int id, int len)
+    {
+        const char *lower = TABLE.lower[id], *mask = TABLE.mask[id];
+        if (len < 8)
+            return same4(name, lower, mask, 0) && same4(name, lower, mask, len - 4);
+        for (int i = 0; i + 8 < len; i += 8)
+        {
+            if (!same8(name, lower, mask, i))
+                return false;
+        }
+        return same8(name, lower, mask, len - 8);
+    }
+
+    static bool same8(const char *name, const char *lower, const char *mask, int i)
+    {
+        uint64_t a, l, m;
+        memcpy(&a, name + i, 8);
+        memcpy(&l, lower + i, 8);
+        memcpy(&m, mask + i, 8);
+        return (a | m) == l;
+    }
+
+    static bool same4(const char *name, const char *lower, const char *mask, int i)
+    {
+        uint32_t a, l, m;
+        memcpy(&a, name + i, 4);
+        memcpy(&l, lower + i, 4);
+        memcpy(&m, mask + i, 4);
+        return (a | m) == l;
+    }
+
+    static const int MIN_LEN = header_hash::min_len();
+    static const int MAX_LEN = header_hash::max_len();
+    static constexpr unsigned SEED = header_hash::find_seed();
+    static_assert(SEED != 0, "no collision-free seed for the header name table");
+    static constexpr header_hash::table TABLE = header_hash::build(SEED);
+    static_assert(header_hash::COUNT == HEADER_COUNT, "HEADER_ID and header_hash::NAMES out of sync");
+    static_assert(MIN_LEN >= 4 && MAX_LEN <= header_hash::NAME_SIZE, "header names must be 4 to NAME_SIZE bytes");
+};
+
+#endif
@@ -0,0 +1,302 @@
+// 请求头的解析: 从状态机按行扫描读缓冲, 主状态机解析请求行和各个字段, 字段记入索引.
+// 不依赖连接的其他部分(文件、数据库、日志), 单独编译, 基准测试(test_presure/parse_bench)直接链接这里的代码
+#include "http_conn.h"
+
+// 跳过空白; 字段值开头一般只有一两个空白, 逐字节内联判断比调用strspn快
+static inline char *skip_space(char *p)
+{
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+static inline const char *skip_space(const char *p)
+{
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+// 逗号分隔的列表中一项的结尾: 空白、逗号、结尾的'\0', 以及stop(没有时为'\0')
+static inline const char *item_end(const char *p, char stop)
+{
+    while (*p && *p != ' ' && *p != '\t' && *p != ',' && *p != stop)
+        p++;
+    return p;
+}
+
+// Connection字段是逗号分隔的选项: 有close时关闭连接, 否则有keep-alive时保持连接, 都没有时为版本的默认值linger
+static bool parse_connection(const char *text, bool linger)
+{
+    while (*text)
+    {
+        while (*text == ' ' || *text == '\t' || *text == ',')
+            text++;
+        const char *end = item_end(text, '\0');
+        size_t len = end - text;
+        if (len == 5 && strncasecmp(text, "close", 5) == 0)
+            return false;
+        if (len == 10 && strncasecmp(text, "keep-alive", 10) == 0)
+            linger = true;
+        text = end;
+    }
+    return linger;
+}
+
+// 解析 Accept-Encoding: gzip, deflate, br;q=0.9 这样的字段, 返回接受的预压缩编码; q=0表示不接受
+static int parse_accept_encoding(const char *text)
+{
+    int mask = 0;
+    while (*text)
+    {
+        while (*text == ' ' || *text == '\t' || *text == ',')
+            text++;
+        const char *name = text;
+        text = item_end(text, ';');
+        size_t len = text - name;
+        text = skip_space(text);
+
+        bool refused = false;
+        while (*text == ';')
+        {
+            text = skip_space(text + 1);
+            if ((text[0] == 'q' || text[0] == 'Q') && text[1] == '=')
+                refused = atof(text + 2) == 0;
+            while (*text && *text != ',' && *text != ';')
+                text++;
+        }
+
+        if (refused || len == 0)
+            continue;
+        if (len == 4 && strncasecmp(name, "gzip", 4) == 0)
+            mask |= http_conn::ENC_GZIP;
+        else if (len == 2 && strncasecmp(name, "br", 2) == 0)
+            mask |= http_conn::ENC_BR;
+        else if (len == 1 && name[0] == '*')
+            mask |= http_conn::ENC_GZIP | http_conn::ENC_BR;
+    }
+    return mask;
+}
+
+// 从状态机，用于读取buffer中一行的内容，并把行之间的'\r''\n'换为'\0''\0'
+// 返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
+// 行尾和冒号由http_scan一批16或32字节地查找, 行分几次到达时从上次停下的位置继续
+http_conn::LINE_STATUS http_conn::parse_line()
+{
+    // 新的一行
+    if (m_checked_idx == m_start_line)
+        m_colon_idx = -1;
+
+    const char *colon = m_colon_idx >= 0 ? m_read_buf + m_colon_idx : NULL;
+    const char *end = m_read_buf + m_read_idx;
+    const char *eol = http_scan::find_line(m_read_buf + m_checked_idx, end, &colon);
+    if (colon)
+        m_colon_idx = colon - m_read_buf;
+    m_checked_idx = eol - m_read_buf;
+
+    // 读到buffer末尾也没有找到\r\n，需要继续recv到buffer
+    if (eol == end)
+        return LINE_OPEN;
+
+    // 当前字符为 '\r'
+    if (*eol == '\r')
+    {
+        if (eol + 1 == end) // '\r'已到达buffer末尾，说明下一个字符'\n'还没被接收，即接受不完整
+            return LINE_OPEN;
+        else if (eol[1] == '\n') // 下一个字符为'\n'，说明读到行尾
+        {
+            // 每行之间的'\r','\n' 换成 '\0','\0' ，方便后续操作; 通过局部指针写, 写字符后不用重新读取成员
+            char *crlf = (char *)eol;
+            crlf[0] = '\0';
+            crlf[1] = '\0';
+            m_checked_idx += 2;
+            return LINE_OK;
+        }
+        // 除上面外都是格式不对
+        return LINE_BAD;
+    }
+
+    // 当前字符为 '\n'; 前面的'\r'已在上一次扫描中处理, 单独的'\n'格式不对
+    return LINE_BAD;
+}
+
+// 解析读缓冲中的请求行和请求头, 到空行为止
+http_conn::HTTP_CODE http_conn::parse_head()
+{
+    // 每一行的'\r''\n'在从状态机中换成'\0', text到end为一行的内容
+    while (parse_line() == LINE_OK)
+    {
+        char *text = get_line();
+        m_start_line = m_checked_idx;   // m_checked_idx 在从状态机中会移到下一行的行首位置
+        char *end = m_read_buf + m_checked_idx - 2;
+
+        HTTP_CODE ret = m_check_state == CHECK_STATE_REQUESTLINE ? parse_request_line(text, end) : parse_headers(text, end);
+        if (ret != NO_REQUEST)
+            return ret;
+    }
+    return NO_REQUEST;
+}
+
+// 解析状态回到请求开始, 读缓冲中的数据不动
+void http_conn::reset_head()
+{
+    m_checked_idx = 0;
+    m_start_line = 0;
+    m_check_state = CHECK_STATE_REQUESTLINE;
+    m_linger = false;
+    m_method = GET;
+    m_url = 0;
+    m_version = 0;
+    m_content_length = 0;
+    m_chunked = false;
+    m_accept_encoding = 0;
+    m_colon_idx = -1;
+    m_known_mask = 0;
+    m_header_count = 0;
+    cgi = 0;
+}
+
+void http_conn::bench_head(char *buf, long size, long len)
+{
+    m_read_buf = buf;
+    m_read_size = size;
+    m_read_idx = len;
+    reset_head();
+}
+
+// 解析http请求行，获得请求方法，目标url及http版本号
+http_conn::HTTP_CODE http_conn::parse_request_line(char *text, char *end)
+{ // 在HTTP报文中，请求行用来说明请求类型，要访问的资源以及所使用的HTTP版本，其中各个部分之间通过 \t 或 空格 分隔。
+
+    m_url = (char *)http_scan::find_space(text, end); // 第一个' '或'\t'的位置
+
+    // 如果没有空格或\t，则报文格式有误
+    if (m_url == end)
+    {
+        return BAD_REQUEST;
+    }
+
+    // 将该位置的' '或'\t'改为\0，用于将前面数据取出
+    int method_len = m_url - text;
+    *m_url++ = '\0';
+
+    // 取出数据，并通过与GET和POST比较，以确定请求方式; 长度已知, 先比较长度
+    char* method = text;
+    if (method_len == 3 && strncasecmp(method, "GET", 3) == 0)
+        m_method = GET;
+    else if (method_len == 4 && strncasecmp(method, "POST", 4) == 0)
+    {
+        m_method = POST;
+        cgi = 1;
+    }
+    else
+        return BAD_REQUEST;
+    
+    // m_url此时跳过了第一个空格或\t字符，但不知道之后是否还有
+    // 将m_url向后偏移，通过查找，继续跳过空格和\t字符，指向请求资源的第一个字符
+    m_url = skip_space(m_url);
+
+    // 类似上面获取m_url的操作,获取m_version
+    m_version = (char *)http_scan::find_space(m_url, end);
+    if (m_version == end)
+        return BAD_REQUEST;
+    *m_version++ = '\0';
+    m_version = skip_space(m_version);
+    // 支持HTTP/1.1和HTTP/1.0. 长连接的默认值随版本不同: 1.1默认保持连接, 1.0默认关闭, 之后的Connection字段可以改变它
+    if (end - m_version != 8 || strncasecmp(m_version, "HTTP/1.", 7) != 0 || (m_version[7] != '1' && m_version[7] != '0'))
+        return BAD_REQUEST;
+    m_linger = m_version[7] == '1';
+
+    
+    // 这里主要是有些报文的请求资源中会带有http:// or https://，这里需要对这种情况进行单独处理;
+    // 一般的请求资源以'/'开头, 不用比较
+    if (m_url[0] != '/')
+    {
+        // 对请求资源前7个字符进行判断，http; 前8个字符，https
+        if (strncasecmp(m_url, "http://", 7) == 0)
+            m_url = strchr(m_url + 7, '/');     // strchr：用于查找字符串中的一个字符，并返回该字符在字符串中第一次出现的位置。
+        else if (strncasecmp(m_url, "https://", 8) == 0)
+            m_url = strchr(m_url + 8, '/');
+    }
+
+    //一般的不会带有上述两种符号，直接是单独的/或/后面带访问资源
+    if (!m_url || m_url[0] != '/')
+        return BAD_REQUEST;
+
+    // 状态转移为 CHECK_STATE_HEADER
+    m_check_state = CHECK_STATE_HEADER;
+    
+    return NO_REQUEST;
+}
+
+//解析http请求的一个头部信息
+// 字段名的长度由扫描行尾时找到的冒号得到, 按长度只和一个已知字段名比较, 不用逐个字段名尝试
+http_conn::HTTP_CODE http_conn::parse_headers(char *text, char *end)
+{
+    if (text[0] == '\0')    // 当前是空行, 请求头结束
+        return GET_REQUEST;
+
+    // 没有冒号的行忽略
+    long line = text - m_read_buf;
+    if (m_colon_idx < line)
+        return NO_REQUEST;
+    int name_len = m_colon_idx - line;
+    char *value = text + name_len + 1;
+    value = skip_space(value);
+
+    header_view field_value = {(unsigned)(value - m_read_buf), (unsigned)(end - value)};
+    if (m_header_count < MAX_HEADERS)
+    {
+        header_field &field = m_headers[m_header_count++];
+        field.name.off = line;
+        field.name.len = name_len;
+        field.value = field_value;
+    }
+
+    // 其他字段只记入索引, 需要时再按名字查找
+    int id = http_header::lookup(text, name_len);
+    if (id == http_header::UNKNOWN)
+        return NO_REQUEST;
+    m_known_mask |= 1u << id;
+    m_known[id] = field_value;
+
+    // 解析请求时就要用到的字段, 其余的(Range、条件请求等)生成响应时用header()取
+    switch (id)
+    {
+    case http_header::CONNECTION:   // 决定是长连接还是短连接
+        m_linger = parse_connection(value, m_linger);
+        break;
+    case http_header::CONTENT_LENGTH:
+        m_content_length = atol(value);
+        if (m_content_length < 0)
+            return BAD_REQUEST;
+        break;
+    case http_header::TRANSFER_ENCODING:    // 请求体只支持chunked编码
+        if (strcasecmp(value, "chunked") != 0)
+            return BAD_REQUEST;
+        m_chunked = true;
+        break;
+    case http_header::ACCEPT_ENCODING:
+        m_accept_encoding = parse_accept_encoding(value);
+        break;
+    }
+    return NO_REQUEST;
+}
+
+// 按名字查找字段: 已知字段直接取, 其他在索引中顺序比较
+const char *http_conn::header(const char *name) const
+{
+    int len = strlen(name);
+    int id = http_header::lookup(name, len);
+    if (id != http_header::UNKNOWN)
+        return header(id);
+
+    for (int i = 0; i < m_header_count; i++)
+    {
+        const header_field &field = m_headers[i];
+        if ((int)field.name.len == len && strncasecmp(m_read_buf + field.name.off, name, len) == 0)
+            return m_read_buf + field.value.off;
+    }
+    return NULL;
+}
+
@@ -0,0 +1,143 @@
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <string.h>
+
+// 路由的匹配方式
+enum ROUTE_MATCH
+{
+    ROUTE_EXACT = 0,    // 路径完全相同
+    ROUTE_PREFIX        // 路径以path开头, 多条前缀路由都匹配时取最长的
+};
+
+// 一条路由. methods按位表示接受的请求方法(第METHOD位), handler是请求收完后的处理函数, arg原样传给它;
+// body处理到达的请求体片段, 为NULL时请求体整个收集起来再交给handler
+template <class Handler, class BodyHandler>
+struct route
+{
+    int methods;
+    ROUTE_MATCH match;
+    const char *path;
+    Handler handler;
+    const char *arg;
+    int lane;           // 请求进线程池的哪个通道
+    BodyHandler body;
+};
+
+// 编译期建好的路由表, 对象只能用constexpr定义, 查找时不分配内存.
+// 精确匹配的路径放进完美哈希表: 路径的每个字节参与哈希, 建表时从1开始试seed, 取第一个没有冲突的;
+// 同一路径的精确路由只能有一条, 接受的方法都写在methods中. 查找时算一次哈希, 比较长度和路径.
+// 前缀路由按前缀从长到短排好, 精确匹配没有命中(或方法不符)时依次比较.
+// 路由表有问题(冲突、路由太多)时构造函数在常量求值中抛出异常, 编译失败
+template <class Handler, class BodyHandler>
+class http_router
+{
+public:
+    static const int TABLE_BITS = 6;    // 精确匹配的哈希表64个槽
+    static const int TABLE_SIZE = 1 << TABLE_BITS;
+    static const int MAX_ROUTES = 32;
+
+    template <int N>
+    constexpr http_router(const route<Handler, BodyHandler> (&routes)[N])
+        : m_routes(routes), m_count(N), m_seed(0), m_len{}, m_slot{}, m_prefix{}, m_prefix_count(0)
+    {
+        if (N > MAX_ROUTES)
+            throw "http_router: too many routes";
+        for (int i = 0; i < N; i++)
+            m_len[i] = length(routes[i].path);
+
+        for (unsigned seed = 1; seed < 100000 && !m_seed; seed++)
+        {
+            if (fill(seed))
+                m_seed = seed;
+        }
+        if (!m_seed)
+            throw "http_router: no collision-free seed for exact routes";
+
+        // 前缀路由按前缀长度从长到短插入排序
+        for (int i = 0; i < N; i++)
+        {
+            if (routes[i].match != ROUTE_PREFIX)
+                continue;
+            int j = m_prefix_count++;
+            while (j > 0 && m_len[m_prefix[j - 1]] < m_len[i])
+            {
+                m_prefix[j] = m_prefix[j - 1];
+                j--;
+            }
+            m_prefix[j] = i;
+        }
+    }
+
+    // 查找[path, path + len)对应的路由, method为请求方法(METHOD); 没有匹配时返回NULL
+    const route<Handler, BodyHandler> *find(int method, const char *path, int len) const
+    {
+        if (len > 0)
+        {
+            int i = m_slot[hash(m_seed, path, len)];
+            if (i >= 0)
+            {
+                const route<Handler, BodyHandler> &r = m_routes[i];
+                if ((r.methods >> method & 1) && m_len[i] == len && memcmp(r.path, path, len) == 0)
+                    return &r;
+            }
+        }
+
+        for (int k = 0; k < m_prefix_count; k++)
+        {
+            const route<Handler, BodyHandler> &r = m_routes[m_prefix[k]];
+            int n = m_len[m_prefix[k]];
+            if ((r.methods >> method & 1) && n <= len && memcmp(r.path, path, n) == 0)
+                return &r;
+        }
+        return NULL;
+    }
+
+private:
+    static constexpr int length(const char *s)
+    {
+        int n = 0;
+        while (s[n])
+            n++;
+        return n;
+    }
+
+    // FNV-1a; 路径常只差一两个字节(如/2CGISQL.cgi和/3CGISQL.cgi), 每个字节都参与
+    static constexpr unsigned hash(unsigned seed, const char *path, int len)
+    {
+        unsigned h = 2166136261u ^ (seed * 0x9e3779b1u);
+        for (int i = 0; i < len; i++)
+            h = (h ^ (unsigned char)path[i]) * 16777619u;
+        h ^= h >> 15;
+        h *= 0x85ebca6bu;
+        return h >> (32 - TABLE_BITS);
+    }
+
+    // 用seed把精确匹配的路由放进哈希表, 有冲突时返回false
+    constexpr bool fill(unsigned seed)
+    {
+        for (int s = 0; s < TABLE_SIZE; s++)
+            m_slot[s] = -1;
+        for (int i = 0; i < m_count; i++)
+        {
+            if (m_routes[i].match != ROUTE_EXACT)
+                continue;
+            unsigned s = hash(seed, m_routes[i].path, m_len[i]);
+            if (m_slot[s] != -1)
+                return false;
+            m_slot[s] = i;
+        }
+        return true;
+    }
+
+private:
+    const route<Handler, BodyHandler> *m_routes;
+    int m_count;
+    unsigned m_seed;
+    int m_len[MAX_ROUTES];              // 各路由路径的长度
+    signed char m_slot[TABLE_SIZE];     // 槽 -> 路由下标, 空槽为-1
+    signed char m_prefix[MAX_ROUTES];   // 前缀路由的下标, 按前缀从长到短
+    int m_prefix_count;
+};
+
+#endif
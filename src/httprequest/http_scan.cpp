@@ -0,0 +1,198 @@
+#include "http_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+/* ============ 逐字节 ============ */
+
+static const char *find_line_scalar(const char *p, const char *end, const char **colon)
+{
+    for (; p < end; p++)
+    {
+        char c = *p;
+        if (c == '\r' || c == '\n')
+            return p;
+        if (c == ':' && !*colon)
+            *colon = p;
+    }
+    return end;
+}
+
+static const char *find_space_scalar(const char *p, const char *end)
+{
+    while (p < end && *p != ' ' && *p != '\t')
+        p++;
+    return p;
+}
+
+#ifdef HTTP_SCAN_X86
+
+/* ============ SSE4.2 ============ */
+
+// 每批16字节逐字节比较(PCMPEQB), movemask得到位图, 最低的置位就是第一个匹配的字节.
+// 要找的字符只有两三个, 比PCMPESTRI的任一字符相等模式快得多
+__attribute__((target("sse4.2")))
+static const char *find_line_sse42(const char *p, const char *end, const char **colon)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i co = _mm_set1_epi8(':');
+
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned eol = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        if (!*colon)
+        {
+            unsigned c = _mm_movemask_epi8(_mm_cmpeq_epi8(v, co));
+            if (eol)
+                c &= (eol & -eol) - 1;  // 只要行尾之前的冒号
+            if (c)
+                *colon = p + __builtin_ctz(c);
+        }
+        if (eol)
+            return p + __builtin_ctz(eol);
+        p += 16;
+    }
+    return find_line_scalar(p, end, colon);
+}
+
+__attribute__((target("sse4.2")))
+static const char *find_space_sse42(const char *p, const char *end)
+{
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)));
+        if (m)
+            return p + __builtin_ctz(m);
+        p += 16;
+    }
+    return find_space_scalar(p, end);
+}
+
+/* ============ AVX2 ============ */
+
+// 每批32字节, 方法同SSE4.2; 不足32字节的尾部先按16字节比较一次.
+// 尾部不调用SSE4.2的实现: 那里是非VEX编码的SSE指令, 与256位的AVX指令交替执行有状态切换的开销
+__attribute__((target("avx2")))
+static const char *find_line_avx2(const char *p, const char *end, const char **colon)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i co = _mm256_set1_epi8(':');
+
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned eol = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+        if (!*colon)
+        {
+            unsigned c = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, co));
+            if (eol)
+                c &= (eol & -eol) - 1;  // 只要行尾之前的冒号
+            if (c)
+                *colon = p + __builtin_ctz(c);
+        }
+        if (eol)
+            return p + __builtin_ctz(eol);
+        p += 32;
+    }
+
+    if (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned eol = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(cr)),
+                                                      _mm_cmpeq_epi8(v, _mm256_castsi256_si128(lf))));
+        if (!*colon)
+        {
+            unsigned c = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(co)));
+            if (eol)
+                c &= (eol & -eol) - 1;
+            if (c)
+                *colon = p + __builtin_ctz(c);
+        }
+        if (eol)
+            return p + __builtin_ctz(eol);
+        p += 16;
+    }
+    return find_line_scalar(p, end, colon);
+}
+
+__attribute__((target("avx2")))
+static const char *find_space_avx2(const char *p, const char *end)
+{
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)));
+        if (m)
+            return p + __builtin_ctz(m);
+        p += 32;
+    }
+    return find_space_scalar(p, end);
+}
+
+#endif
+
+/* ============ 选择实现 ============ */
+
+int http_scan::detect()
+{
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SCAN_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return SCAN_SSE42;
+#endif
+    return SCAN_SCALAR;
+}
+
+int http_scan::s_impl = SCAN_SCALAR;
+http_scan::line_func http_scan::s_find_line = find_line_scalar;
+http_scan::space_func http_scan::s_find_space = find_space_scalar;
+
+// 静态初始化时按CPU选择, 在任何请求到达之前完成
+static bool scan_selected = http_scan::select(http_scan::SCAN_AVX2) || http_scan::select(http_scan::SCAN_SSE42);
+
+bool http_scan::select(int impl)
+{
+    if (impl > detect())
+        return false;
+
+    switch (impl)
+    {
+#ifdef HTTP_SCAN_X86
+    case SCAN_AVX2:
+        s_find_line = find_line_avx2;
+        s_find_space = find_space_avx2;
+        break;
+    case SCAN_SSE42:
+        s_find_line = find_line_sse42;
+        s_find_space = find_space_sse42;
+        break;
+#endif
+    default:
+        impl = SCAN_SCALAR;
+        s_find_line = find_line_scalar;
+        s_find_space = find_space_scalar;
+        break;
+    }
+    s_impl = impl;
+    return true;
+}
+
+const char *http_scan::impl_name()
+{
+    static const char *names[] = {"scalar", "sse4.2", "avx2"};
+    return names[s_impl];
+}
@@ -0,0 +1,48 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+// 请求报文扫描: 一次比较16或32个字节, 查找行尾、冒号和请求行中的分隔符.
+// 启动时按CPU支持的指令集选择AVX2、SSE4.2或逐字节的实现, 结果与逐字节扫描完全相同;
+// 只读取[p, end)内的字节, 不足一批的尾部逐字节处理
+class http_scan
+{
+public:
+    enum SCAN_IMPL
+    {
+        SCAN_SCALAR = 0,
+        SCAN_SSE42,
+        SCAN_AVX2
+    };
+
+    // 从p开始查找第一个'\r'或'\n', 没有时返回end;
+    // *colon为NULL时顺便记下行尾之前的第一个':', 行分几次到达时找到的冒号保留在*colon中
+    static const char *find_line(const char *p, const char *end, const char **colon)
+    {
+        return s_find_line(p, end, colon);
+    }
+
+    // 从p开始查找第一个' '或'\t', 没有时返回end
+    static const char *find_space(const char *p, const char *end)
+    {
+        return s_find_space(p, end);
+    }
+
+    static int impl() { return s_impl; }
+    static const char *impl_name();
+    // 指定实现(基准测试用), CPU不支持时返回false
+    static bool select(int impl);
+
+private:
+    typedef const char *(*line_func)(const char *, const char *, const char **);
+    typedef const char *(*space_func)(const char *, const char *);
+
+    static int detect();
+
+    static int s_impl;
+    static line_func s_find_line;
+    static space_func s_find_space;
+};
+
+#endif
@@ -2,8 +2,14 @@
 #define LOCKER_H
 
 #include <exception>
+#include <atomic>
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 // 信号量封装（ P V 操作，可用于同步）
 class sem
@@ -21,7 +27,7 @@ public:
     // 信号量的值设为num
     sem(int num)
     {
-        if (sem_init(&m_sem, 0, 0) != 0)
+        if (sem_init(&m_sem, 0, num) != 0)
             throw std::exception();
     }
 
@@ -42,6 +48,72 @@ public:
     }
 };
 
+// 先自旋再futex睡眠的信号量
+// 计数为正时wait只是一次CAS, 不进内核; 任务连续到来时工作线程自旋一会就能拿到, 省掉一次睡眠和唤醒;
+// 计数为负表示有线程在等, post才需要futex唤醒
+class spin_sem
+{
+private:
+    std::atomic<int> m_count;       // 可用资源数, 负数为等待的线程数
+    std::atomic<int> m_wakeups;     // post发给睡眠线程的唤醒数, 也是futex的等待地址
+    int m_spin;                     // 睡眠前自旋尝试的次数
+
+    static void futex_wait(std::atomic<int> *addr, int val)
+    {
+        syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+    }
+    static void futex_wake(std::atomic<int> *addr, int num)
+    {
+        syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+    }
+
+public:
+    // 单核上自旋只会抢走生产者的CPU, 不自旋
+    spin_sem(int num = 0, int spin = 1000) : m_count(num), m_wakeups(0)
+    {
+        m_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? spin : 0;
+    }
+
+    // P
+    bool wait()
+    {
+        // 自旋: 有资源就直接取走
+        for (int i = 0; i < m_spin; i++)
+        {
+            int c = m_count.load(std::memory_order_relaxed);
+            if (c > 0 && m_count.compare_exchange_weak(c, c - 1, std::memory_order_acquire))
+                return true;
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+
+        if (m_count.fetch_sub(1, std::memory_order_acquire) > 0)
+            return true;
+
+        // 已登记为等待者, 睡到某次post把唤醒数加上来
+        while (true)
+        {
+            int w = m_wakeups.load(std::memory_order_relaxed);
+            if (w > 0 && m_wakeups.compare_exchange_weak(w, w - 1, std::memory_order_acquire))
+                return true;
+            if (w == 0)
+                futex_wait(&m_wakeups, 0);
+        }
+    }
+
+    // V
+    bool post()
+    {
+        if (m_count.fetch_add(1, std::memory_order_release) < 0)
+        {
+            m_wakeups.fetch_add(1, std::memory_order_release);
+            futex_wake(&m_wakeups, 1);
+        }
+        return true;
+    }
+};
+
 // 互斥锁
 class locker
 {
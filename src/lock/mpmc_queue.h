@@ -0,0 +1,110 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <exception>
+#include <stddef.h>
+#include <stdint.h>
+
+// 有界无锁多生产者多消费者队列(Dmitry Vyukov的环形队列)
+// 每个槽有一个序号: 序号等于位置时可写, 等于位置+1时可读; 生产者和消费者各自用CAS抢位置,
+// 抢到之后只读写自己的槽, 不需要锁, 也不需要为每个元素分配链表结点
+template <typename T>
+class mpmc_queue
+{
+private:
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    // 入队和出队位置分开放在不同的缓存行, 避免生产者和消费者互相使对方的缓存行失效
+    static const size_t CACHELINE = 64;
+
+    cell *m_buffer;
+    size_t m_mask;
+    char m_pad0[CACHELINE];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_pad1[CACHELINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeue_pos;
+    char m_pad2[CACHELINE - sizeof(std::atomic<size_t>)];
+
+public:
+    // 容量向上取整到2的幂
+    explicit mpmc_queue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        m_buffer = new cell[size];
+        m_mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            m_buffer[i].seq.store(i, std::memory_order_relaxed);
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpmc_queue()
+    {
+        delete[] m_buffer;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // 队列满时返回false
+    bool push(const T &data)
+    {
+        cell *c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)      // 槽空闲, 抢这个位置
+            {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)  // 槽还没被消费, 队列满
+                return false;
+            else                // 被别的生产者抢先了
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+
+        c->data = data;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空(或队首的元素还在写入)时返回false
+    bool pop(T &data)
+    {
+        cell *c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)      // 槽里有数据, 抢这个位置
+            {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)  // 空
+                return false;
+            else                // 被别的消费者抢先了
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+
+        data = c->data;
+        // 序号推进一整圈, 留给下一轮的生产者
+        c->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif
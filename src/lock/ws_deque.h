@@ -0,0 +1,76 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Chase-Lev 工作窃取双端队列(固定容量)
+// 拥有者从bottom端放入, 任意线程从top端窃取, 窃取之间只靠一次CAS竞争top.
+// 线程池里放任务的是事件循环而不是工作线程自己, 所以这里只保留push和steal:
+// 工作线程取自己队列里的任务也走steal(按到达顺序), 多个事件循环push时由调用者串行化
+template <typename T>
+class ws_deque
+{
+private:
+    static const size_t CACHELINE = 64;
+
+    std::atomic<long> m_top;
+    char m_pad0[CACHELINE - sizeof(std::atomic<long>)];
+    std::atomic<long> m_bottom;
+    char m_pad1[CACHELINE - sizeof(std::atomic<long>)];
+    std::atomic<T> *m_buffer;
+    long m_mask;
+
+public:
+    // 容量向上取整到2的幂
+    explicit ws_deque(size_t capacity) : m_top(0), m_bottom(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_buffer = new std::atomic<T>[size];
+        m_mask = size - 1;
+    }
+
+    ~ws_deque()
+    {
+        delete[] m_buffer;
+    }
+
+    // 当前任务数的近似值, 用来挑选较空的队列
+    long size() const
+    {
+        long b = m_bottom.load(std::memory_order_relaxed);
+        long t = m_top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    // 拥有者放入, 满时返回false
+    bool push(T data)
+    {
+        long b = m_bottom.load(std::memory_order_relaxed);
+        long t = m_top.load(std::memory_order_acquire);
+        if (b - t > m_mask)
+            return false;
+
+        m_buffer[b & m_mask].store(data, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 从top端窃取, 队列空或与其他线程竞争失败时返回false
+    bool steal(T &data)
+    {
+        long t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return false;
+
+        data = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+        return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+};
+
+#endif
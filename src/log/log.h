@@ -29,6 +29,7 @@ public:
     static void *flush_log_thread(void *args)
     {
         Log::get_instance()->async_write_log();
+        return NULL;
     }
 
     // 可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
@@ -55,6 +56,7 @@ private:
             fputs(single_log.c_str(),m_fp);
             m_mutex.unlock();
         }
+        return NULL;
     }
 
 private:
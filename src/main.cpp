@@ -17,7 +17,11 @@ int main(int argc, char *argv[])
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                 config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.reactor_num,
+                config.io_backend, config.work_steal,
+                config.file_cache_mb, config.file_cache_num, config.send_budget,
+                config.resp_cache_mb, config.precompress,
+                config.max_read_buf, config.max_write_buf);
 
 
     //日志
@@ -26,6 +30,9 @@ int main(int argc, char *argv[])
     //数据库
     server.sql_pool();
 
+    //静态文件缓存
+    server.file_pool();
+
     //线程池
     server.thread_pool();
 
@@ -0,0 +1,165 @@
+// 对运行中的服务器逐项检查响应是否正确, 用于修复之后的回归检查
+// 用法: ./http_check 端口 网站根目录 , 例如 ./http_check 9006 ../../webserver/root
+// 需要在网站根目录下临时创建测试文件, 检查结束后删除; 有的检查要等连接超时, 全部约需20秒; 全部通过时返回0
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int port;
+static std::string root;
+
+static int connect_server()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 发送请求后读到对方关闭连接或timeout_ms内没有数据为止
+static std::string request(const char *req, int timeout_ms = 2000)
+{
+    std::string out;
+    int fd = connect_server();
+    if (fd < 0)
+        return out;
+    write(fd, req, strlen(req));
+
+    char buf[4096];
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (poll(&pfd, 1, timeout_ms) > 0)
+    {
+        int n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        out.append(buf, n);
+    }
+    close(fd);
+    return out;
+}
+
+static int count(const std::string &s, const char *sub)
+{
+    int n = 0;
+    for (size_t i = s.find(sub); i != std::string::npos; i = s.find(sub, i + 1))
+        n++;
+    return n;
+}
+
+// 大小为0的文件: 只有一个200响应, 响应体为空白页面
+static bool check_empty_file()
+{
+    std::string path = root + "/http_check_empty.html";
+    int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0)
+    {
+        printf("  cannot create %s\n", path.c_str());
+        return false;
+    }
+    close(fd);
+
+    std::string resp = request("GET /http_check_empty.html HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n");
+    unlink(path.c_str());
+
+    size_t body = resp.find("\r\n\r\n");
+    bool ok = resp.compare(0, 12, "HTTP/1.1 200") == 0 && count(resp, "HTTP/1.1 ") == 1 &&
+              body != std::string::npos && resp.substr(body + 4) == "<html><body></body></html>";
+    if (!ok)
+        printf("  response: %s\n", resp.c_str());
+    return ok;
+}
+
+// 在长连接fd上发送一个请求, 读完一个响应(按Content-Length), 返回状态行; 连接已断开时返回空串
+static std::string get_on(int fd, const char *path)
+{
+    char req[256];
+    snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: x\r\nConnection: keep-alive\r\n\r\n", path);
+    if (write(fd, req, strlen(req)) < 0)
+        return "";
+
+    std::string resp;
+    char buf[4096];
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (poll(&pfd, 1, 2000) > 0)
+    {
+        int n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            return "";
+        resp.append(buf, n);
+        size_t head = resp.find("\r\n\r\n");
+        size_t len = resp.find("Content-Length:");
+        if (head != std::string::npos && len != std::string::npos &&
+            resp.size() >= head + 4 + atol(resp.c_str() + len + 15))
+            return resp.substr(0, resp.find("\r\n"));
+    }
+    return "";
+}
+
+// 出错关闭的连接, fd被新连接复用后, 旧连接的定时器不能关闭新连接:
+// 连接A请求不存在的文件被关闭, 连接B复用它的fd, 在A的超时时间(15秒)前后都有请求, 应当一直保持
+static bool check_closed_fd_reuse()
+{
+    request("GET /http_check_missing.html HTTP/1.1\r\nHost: x\r\n\r\n");
+
+    int fd = connect_server();
+    if (fd < 0)
+        return false;
+    bool ok = true;
+    for (int t = 0; t <= 16 && ok; t += 4)
+    {
+        std::string status = get_on(fd, "/");
+        ok = status.compare(0, 12, "HTTP/1.1 200") == 0;
+        if (!ok)
+            printf("  request at %ds: %s\n", t, status.empty() ? "connection closed" : status.c_str());
+        else if (t < 16)
+            sleep(4);
+    }
+    close(fd);
+    return ok;
+}
+
+struct check
+{
+    const char *name;
+    bool (*func)();
+};
+
+static const check checks[] = {
+    {"empty file", check_empty_file},
+    {"closed fd reuse", check_closed_fd_reuse},
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("usage: %s port root\n", argv[0]);
+        return 2;
+    }
+    port = atoi(argv[1]);
+    root = argv[2];
+
+    int failed = 0;
+    for (const check &c : checks)
+    {
+        bool ok = c.func();
+        printf("%-24s %s\n", c.name, ok ? "ok" : "FAILED");
+        failed += !ok;
+    }
+    return failed ? 1 : 0;
+}
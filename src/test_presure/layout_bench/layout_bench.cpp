@@ -0,0 +1,437 @@
+// 连接对象布局对比: 原来的http_conn字段顺序 + 单独的client_data数组, 与现在的热/冷分区、按缓存行对齐的conn_slot.
+// 两种布局的字段类型和大小与服务器中的一致, 按服务器处理一个请求的顺序访问字段:
+// 事件循环刷新定时器、读数据、入队; 工作线程解析、生成响应; 事件循环发送.
+// 单线程测试随机访问大量连接, 看每个请求触及的缓存行; 双线程测试事件循环给连接i入队的同时工作线程处理连接i-1,
+// 看相邻连接之间的伪共享. 用perf_event_open统计缓存未命中, 不可用时只输出耗时.
+// 用法: ./layout_bench [连接数] [请求数], 默认 20000 4000000
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <map>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/perf_event.h>
+
+using namespace std;
+
+struct send_seg
+{
+    const char *base;
+    int fd;
+    off_t offset;
+    size_t len;
+};
+
+struct util_timer
+{
+    long long expire;
+    void (*cb_func)(void *);
+    void *user_data;
+    int slot;
+    util_timer *prev;
+    util_timer *next;
+};
+
+struct client_data
+{
+    sockaddr_in address;
+    int sockfd;
+    int epollfd;
+    util_timer *timer;
+    util_timer timer_node;
+};
+
+struct uring_conn
+{
+    unsigned gen;
+    bool writing;
+    string pending;
+};
+
+// 原来的http_conn: 字段按功能的添加顺序排列, 线程池调度字段和timer_flag分在对象两端
+struct old_conn
+{
+    int m_epollfd;
+    int m_state;
+    int m_lane;
+    long long m_queue_time;
+    int m_sockfd;
+    sockaddr_in m_address;
+    char *m_read_buf;
+    long m_read_size;
+    long m_read_idx;
+    long m_checked_idx;
+    int m_start_line;
+    char *m_write_buf;
+    int m_write_size;
+    int m_write_idx;
+    int m_header_idx;
+    int m_check_state;
+    int m_method;
+    char m_real_file[200];
+    char *m_url;
+    char *m_version;
+    char *m_host;
+    long m_content_length;
+    char m_content_tail;
+    bool m_linger;
+    bool m_keep_alive;
+    char *m_range;
+    char *m_if_range;
+    char *m_if_none_match;
+    char *m_if_modified_since;
+    struct stat m_file_stat;
+    int m_accept_encoding;
+    const char *m_encoding;
+    bool m_vary;
+    void *m_file;
+    void *m_resp;
+    vector<void *> m_held_files;
+    vector<void *> m_held_resps;
+    struct iovec m_iv[16];
+    int m_iv_count;
+    vector<send_seg> m_send_queue;
+    size_t m_send_head;
+    string m_part_buf;
+    int cgi;
+    char *m_string;
+    long long bytes_to_send;
+    char *doc_root;
+    map<string, string> m_users;
+    int m_TRIGMode;
+    int m_close_log;
+    char sql_user[100];
+    char sql_passwd[100];
+    char sql_name[100];
+    int timer_flag;
+};
+
+// 现在的http_conn: 调度字段独占一个缓存行, 热数据从下一个缓存行开始连续存放, 配置移到静态成员
+struct new_conn
+{
+    alignas(64) int m_state;
+    int m_lane;
+    int timer_flag;
+    long long m_queue_time;
+
+    alignas(64) int m_sockfd;
+    int m_epollfd;
+    int m_check_state;
+    int m_method;
+    bool m_linger;
+    bool m_keep_alive;
+    bool m_vary;
+    char m_content_tail;
+    int m_start_line;
+    long m_read_idx;
+    long m_checked_idx;
+    long m_read_size;
+    char *m_read_buf;
+    char *m_write_buf;
+    int m_write_size;
+    int m_write_idx;
+    int m_header_idx;
+    int m_iv_count;
+    long long bytes_to_send;
+    size_t m_send_head;
+    vector<send_seg> m_send_queue;
+    long m_content_length;
+    void *m_file;
+    void *m_resp;
+    struct iovec m_iv[16];
+
+    char *m_url;
+    char *m_version;
+    char *m_host;
+    char *m_range;
+    char *m_if_range;
+    char *m_if_none_match;
+    char *m_if_modified_since;
+    char *m_string;
+    int cgi;
+    int m_accept_encoding;
+    const char *m_encoding;
+    char m_real_file[200];
+    struct stat m_file_stat;
+    string m_part_buf;
+
+    vector<void *> m_held_files;
+    vector<void *> m_held_resps;
+    sockaddr_in m_address;
+
+    static int m_TRIGMode;
+};
+int new_conn::m_TRIGMode = 0;
+
+struct conn_slot
+{
+    client_data data;
+    uring_conn uring;
+    conn_slot *next_free;
+    new_conn conn;
+};
+
+// 两种布局的存储: 原来是两个按fd索引的数组, 现在是slab中的conn_slot
+struct old_layout
+{
+    vector<old_conn> conns;
+    vector<client_data> datas;
+    old_layout(int n) : conns(n), datas(n) {}
+    old_conn &conn(int i) { return conns[i]; }
+    client_data &data(int i) { return datas[i]; }
+};
+
+struct new_layout
+{
+    vector<conn_slot> slots;
+    new_layout(int n) : slots(n) {}
+    new_conn &conn(int i) { return slots[i].conn; }
+    client_data &data(int i) { return slots[i].data; }
+};
+
+static char g_buf[4096];
+
+// 事件循环: 读事件刷新定时器, 读入数据后交给线程池
+template <class L>
+static inline void loop_dispatch(L &l, int i, long long now)
+{
+    client_data &d = l.data(i);
+    util_timer *t = d.timer;
+    t->expire = now + 15000;
+    t->slot ^= 1;
+
+    auto &c = l.conn(i);
+    if (c.m_read_buf && c.m_read_idx + 1 < c.m_read_size && c.m_TRIGMode == 0 && c.m_sockfd >= 0)
+        c.m_read_idx += 64;
+    c.m_state = 0;
+    c.m_lane = 0;
+    c.m_queue_time = now;
+}
+
+// 工作线程: 解析请求、生成响应头、排入发送队列
+template <class L>
+static inline void worker_process(L &l, int i)
+{
+    auto &c = l.conn(i);
+    c.m_checked_idx = c.m_read_idx;
+    c.m_start_line = (int)c.m_checked_idx;
+    c.m_check_state = 2;
+    c.m_method = 0;
+    c.m_linger = true;
+    c.m_keep_alive = c.m_linger;
+    c.m_content_length = 0;
+    c.m_write_idx = c.m_header_idx + 100;
+    c.m_file = g_buf;
+    c.m_resp = NULL;
+    c.bytes_to_send = c.m_write_idx + 512;
+    c.m_iv[0].iov_base = c.m_write_buf;
+    c.m_iv[0].iov_len = c.m_write_idx;
+    c.m_iv_count = 1;
+    c.timer_flag = 0;
+}
+
+// 事件循环: 可写事件, 发完后重置
+template <class L>
+static inline void loop_write(L &l, int i)
+{
+    auto &c = l.conn(i);
+    if (c.m_iv_count > 0 && c.m_epollfd >= 0)
+        c.bytes_to_send -= c.m_iv[0].iov_len;
+    c.m_send_head = c.m_send_queue.size();
+    c.m_read_idx = 0;
+    c.m_write_idx = 0;
+}
+
+template <class L>
+static void init_layout(L &l, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        client_data &d = l.data(i);
+        d.timer = &d.timer_node;
+        d.timer_node.slot = 0;
+        auto &c = l.conn(i);
+        c.m_sockfd = i;
+        c.m_epollfd = 3;
+        c.m_read_buf = g_buf;
+        c.m_read_size = 1024;
+        c.m_read_idx = 0;
+        c.m_write_buf = g_buf;
+        c.m_header_idx = 0;
+        c.m_iv_count = 0;
+        c.m_send_head = 0;
+    }
+}
+
+/* ============ 硬件计数器 ============ */
+
+struct counters
+{
+    int fds[2];
+    const char *names[2];
+};
+
+static int open_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;   // 包括之后创建的线程
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void counters_open(counters &c)
+{
+    c.names[0] = "cache-misses";
+    c.fds[0] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    c.names[1] = "L1d-misses";
+    c.fds[1] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+static void counters_start(counters &c)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (c.fds[i] >= 0)
+        {
+            ioctl(c.fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c.fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+static void counters_stop(counters &c, long requests)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        uint64_t value = 0;
+        if (c.fds[i] < 0 || (ioctl(c.fds[i], PERF_EVENT_IOC_DISABLE, 0), read(c.fds[i], &value, sizeof(value)) != sizeof(value)))
+            printf(" %14s", "n/a");
+        else
+            printf(" %9.2f/req", (double)value / requests);
+    }
+}
+
+/* ============ 测试 ============ */
+
+// 单线程: 随机顺序处理请求, 每个请求完整走一遍读、处理、写
+template <class L>
+static void run_single(const char *name, int n, long requests, counters &pc)
+{
+    L *l = new L(n);
+    init_layout(*l, n);
+    vector<int> order(1 << 20);
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        order[i] = x % n;
+    }
+
+    counters_start(pc);
+    auto start = std::chrono::steady_clock::now();
+    for (long r = 0; r < requests; r++)
+    {
+        int i = order[r & (order.size() - 1)];
+        loop_dispatch(*l, i, r);
+        worker_process(*l, i);
+        loop_write(*l, i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+    printf("%-8s single  %7.1f ns/req", name, secs * 1e9 / requests);
+    counters_stop(pc, requests);
+    printf("\n");
+    delete l;
+}
+
+template <class L>
+struct pair_arg
+{
+    L *l;
+    int n;
+    long requests;
+    std::atomic<long> *progress;
+};
+
+// 工作线程: 跟在事件循环后面处理前一个连接
+template <class L>
+static void *pair_worker(void *p)
+{
+    pair_arg<L> *a = (pair_arg<L> *)p;
+    for (long r = 0; r < a->requests; r++)
+    {
+        while (a->progress->load(std::memory_order_acquire) <= r)
+            ;
+        int i = r % a->n;
+        if (i > 0)
+            worker_process(*a->l, i - 1);
+    }
+    return NULL;
+}
+
+// 双线程: 事件循环按顺序给连接i入队的同时, 工作线程处理连接i-1
+template <class L>
+static void run_pair(const char *name, int n, long requests, counters &pc)
+{
+    L *l = new L(n);
+    init_layout(*l, n);
+    std::atomic<long> progress(0);
+    pair_arg<L> a = {l, n, requests, &progress};
+
+    counters_start(pc);
+    auto start = std::chrono::steady_clock::now();
+    pthread_t tid;
+    pthread_create(&tid, NULL, pair_worker<L>, &a);
+    for (long r = 0; r < requests; r++)
+    {
+        loop_dispatch(*l, r % n, r);
+        progress.store(r + 1, std::memory_order_release);
+    }
+    pthread_join(tid, NULL);
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+    printf("%-8s pair    %7.1f ns/req", name, secs * 1e9 / requests);
+    counters_stop(pc, requests);
+    printf("\n");
+    delete l;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 20000;
+    long requests = argc > 2 ? atol(argv[2]) : 4000000;
+
+    printf("sizeof: old http_conn %zu + client_data %zu, new conn_slot %zu\n",
+           sizeof(old_conn), sizeof(client_data), sizeof(conn_slot));
+
+    counters pc;
+    counters_open(pc);
+    if (pc.fds[0] < 0 && pc.fds[1] < 0)
+        printf("perf_event_open unavailable, only timing is reported\n");
+    printf("%-8s %-7s %15s %14s %14s\n", "layout", "test", "time", pc.names[0], pc.names[1]);
+
+    run_single<old_layout>("old", n, requests, pc);
+    run_single<new_layout>("new", n, requests, pc);
+    run_pair<old_layout>("old", n, requests, pc);
+    run_pair<new_layout>("new", n, requests, pc);
+    return 0;
+}
@@ -0,0 +1,322 @@
+// 请求解析对比: 原来逐字节查找行尾、按字段名逐个strncasecmp的解析, 与服务器现在的解析.
+// 原来的解析是改动之前http_conn中代码的副本(去掉了日志), 作为固定的基准; 现在的解析直接调用
+// http_conn::parse_head, 与服务器运行的是同一份代码(http_parse.cpp), 只解析请求行和请求头, 不生成响应.
+// 报文为浏览器发出的典型GET请求; 现在的解析依次用逐字节、SSE4.2、AVX2三种扫描实现各测一遍, 并检查两种解析找到的字段相同.
+// 每轮先把报文拷回缓冲区(解析会把行尾改成'\0'), 拷贝的开销两边相同; 分5段计时取最快的一段.
+// 用法: ./parse_bench [轮数], 默认 2000000
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <chrono>
+#include "../../httprequest/http_conn.h"
+
+using namespace std;
+
+static const char REQUEST[] =
+    "GET /static/js/app.3f9c2b1e.js?v=20261017 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"129\", \"Not=A?Brand\";v=\"8\", \"Google Chrome\";v=\"129\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/129.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: */*\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Referer: https://www.example.com/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1728000000; session=7d1f0c2e9a8b4f6e8c3d2b1a0f9e8d7c; theme=dark; _ga_ABCDEF=GS1.1.1729000000.3.1.1729000100.0.0.0\r\n"
+    "If-None-Match: \"66f1a2b3-1c2d\"\r\n"
+    "If-Modified-Since: Mon, 23 Sep 2024 08:15:31 GMT\r\n"
+    "\r\n";
+
+/* ============ 原来的解析 ============ */
+
+static int old_accept_encoding(const char *text)
+{
+    int mask = 0;
+    while (*text)
+    {
+        text += strspn(text, " \t,");
+        const char *name = text;
+        size_t len = strcspn(text, " \t,;");
+        text += len;
+        text += strspn(text, " \t");
+
+        bool refused = false;
+        while (*text == ';')
+        {
+            text++;
+            text += strspn(text, " \t");
+            if ((text[0] == 'q' || text[0] == 'Q') && text[1] == '=')
+                refused = atof(text + 2) == 0;
+            text += strcspn(text, ",;");
+        }
+
+        if (refused || len == 0)
+            continue;
+        if (len == 4 && strncasecmp(name, "gzip", 4) == 0)
+            mask |= 1;
+        else if (len == 2 && strncasecmp(name, "br", 2) == 0)
+            mask |= 2;
+    }
+    return mask;
+}
+
+struct old_parser
+{
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST };
+    enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
+    enum CHECK_STATE { CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER };
+
+    char buf[2048];
+    int read_idx;
+    int checked_idx;
+    int start_line;
+    CHECK_STATE check_state;
+    char *url;
+    char *version;
+    char *host;
+    char *connection;
+    char *accept_encoding_value;
+    char *if_none_match;
+    char *if_modified_since;
+    long content_length;
+    int accept_encoding;
+    bool linger;
+
+    void reset()
+    {
+        memcpy(buf, REQUEST, sizeof(REQUEST) - 1);
+        read_idx = sizeof(REQUEST) - 1;
+        checked_idx = 0;
+        start_line = 0;
+        check_state = CHECK_STATE_REQUESTLINE;
+        url = version = host = connection = accept_encoding_value = if_none_match = if_modified_since = NULL;
+        content_length = 0;
+        accept_encoding = 0;
+        linger = false;
+    }
+
+    LINE_STATUS parse_line()
+    {
+        for (; checked_idx < read_idx; ++checked_idx)
+        {
+            char temp = buf[checked_idx];
+            if (temp == '\r')
+            {
+                if ((checked_idx + 1) == read_idx)
+                    return LINE_OPEN;
+                else if (buf[checked_idx + 1] == '\n')
+                {
+                    buf[checked_idx++] = '\0';
+                    buf[checked_idx++] = '\0';
+                    return LINE_OK;
+                }
+                return LINE_BAD;
+            }
+            else if (temp == '\n')
+            {
+                if (checked_idx > 1 && buf[checked_idx - 1] == '\r')
+                {
+                    buf[checked_idx - 1] = '\0';
+                    buf[checked_idx++] = '\0';
+                    return LINE_OK;
+                }
+                return LINE_BAD;
+            }
+        }
+        return LINE_OPEN;
+    }
+
+    HTTP_CODE parse_request_line(char *text)
+    {
+        url = strpbrk(text, " \t");
+        if (!url)
+            return BAD_REQUEST;
+        *url++ = '\0';
+        if (strcasecmp(text, "GET") != 0 && strcasecmp(text, "POST") != 0)
+            return BAD_REQUEST;
+        url += strspn(url, " \t");
+        version = strpbrk(url, " \t");
+        if (!version)
+            return BAD_REQUEST;
+        *version++ = '\0';
+        version += strspn(version, " \t");
+        if (strcasecmp(version, "HTTP/1.1") != 0)
+            return BAD_REQUEST;
+        if (url[0] != '/')
+            return BAD_REQUEST;
+        check_state = CHECK_STATE_HEADER;
+        return NO_REQUEST;
+    }
+
+    HTTP_CODE parse_headers(char *text)
+    {
+        if (text[0] == '\0')
+            return GET_REQUEST;
+        else if (strncasecmp(text, "Connection:", 11) == 0)
+        {
+            text += 11;
+            text += strspn(text, " \t");
+            connection = text;
+            if (strcasecmp(text, "keep-alive") == 0)
+                linger = true;
+        }
+        else if (strncasecmp(text, "Content-length:", 15) == 0)
+        {
+            text += 15;
+            text += strspn(text, " \t");
+            content_length = atol(text);
+        }
+        else if (strncasecmp(text, "Host:", 5) == 0)
+        {
+            text += 5;
+            text += strspn(text, " \t");
+            host = text;
+        }
+        else if (strncasecmp(text, "Range:", 6) == 0)
+        {
+        }
+        else if (strncasecmp(text, "If-Range:", 9) == 0)
+        {
+        }
+        else if (strncasecmp(text, "Accept-Encoding:", 16) == 0)
+        {
+            text += 16;
+            text += strspn(text, " \t");
+            accept_encoding_value = text;
+            accept_encoding = old_accept_encoding(text);
+        }
+        else if (strncasecmp(text, "If-None-Match:", 14) == 0)
+        {
+            text += 14;
+            text += strspn(text, " \t");
+            if_none_match = text;
+        }
+        else if (strncasecmp(text, "If-Modified-Since:", 18) == 0)
+        {
+            text += 18;
+            text += strspn(text, " \t");
+            if_modified_since = text;
+        }
+        return NO_REQUEST;
+    }
+
+    bool parse()
+    {
+        LINE_STATUS line_status;
+        while ((line_status = parse_line()) == LINE_OK)
+        {
+            char *text = buf + start_line;
+            start_line = checked_idx;
+            HTTP_CODE ret = check_state == CHECK_STATE_REQUESTLINE ? parse_request_line(text) : parse_headers(text);
+            if (ret != NO_REQUEST)
+                return ret == GET_REQUEST;
+        }
+        return false;
+    }
+};
+
+/* ============ 现在的解析: 直接调用服务器的http_conn::parse_head ============ */
+
+struct new_parser
+{
+    char buf[2048];
+    http_conn conn;
+
+    void reset()
+    {
+        memcpy(buf, REQUEST, sizeof(REQUEST) - 1);
+        conn.bench_head(buf, sizeof(buf), sizeof(REQUEST) - 1);
+    }
+
+    bool parse() { return conn.parse_head() == http_conn::GET_REQUEST; }
+
+    // 字段值在读缓冲中的位置, 没有时为-1
+    long field(int id) const
+    {
+        const char *v = conn.header(id);
+        return v ? v - buf : -1;
+    }
+};
+
+// 两种解析找到的字段值位置相同, 并且都已在行尾截断
+static bool same(const old_parser &a, const new_parser &b)
+{
+    const char *old_fields[] = {a.host, a.if_none_match, a.if_modified_since, a.accept_encoding_value, a.connection};
+    const int ids[] = {http_header::HOST, http_header::IF_NONE_MATCH, http_header::IF_MODIFIED_SINCE,
+                       http_header::ACCEPT_ENCODING, http_header::CONNECTION};
+    for (int i = 0; i < 5; i++)
+    {
+        long pos = old_fields[i] ? old_fields[i] - a.buf : -1;
+        if (pos != b.field(ids[i]) || (pos >= 0 && strcmp(a.buf + pos, b.buf + pos) != 0))
+            return false;
+    }
+    return b.conn.header("sec-ch-ua-platform") && strcmp(b.conn.header("sec-ch-ua-platform"), "\"Windows\"") == 0;
+}
+
+template <class P>
+static double run_once(P &p, long rounds)
+{
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < rounds; i++)
+    {
+        p.reset();
+        if (!p.parse())
+        {
+            printf("parse failed\n");
+            exit(1);
+        }
+    }
+    chrono::duration<double, std::nano> ns = chrono::steady_clock::now() - start;
+    return ns.count() / rounds;
+}
+
+// 两种解析交替各测一段, 共5轮, 各取最快的一段: 减少其他进程的干扰, 并且两边受干扰的机会相同
+template <class P, class Q>
+static void run(P &a, Q &b, long rounds, double &best_a, double &best_b)
+{
+    best_a = best_b = 1e30;
+    for (int i = 0; i < 5; i++)
+    {
+        double ns = run_once(a, rounds / 5);
+        if (ns < best_a)
+            best_a = ns;
+        ns = run_once(b, rounds / 5);
+        if (ns < best_b)
+            best_b = ns;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 2000000;
+    double bytes = sizeof(REQUEST) - 1;
+
+    static old_parser op;
+    static new_parser np;
+
+    printf("request %d bytes, %ld rounds\n", (int)bytes, rounds);
+    printf("%-8s %12s %12s %10s %8s\n", "scan", "old ns/req", "new ns/req", "new MB/s", "speedup");
+
+    const int impls[] = {http_scan::SCAN_SCALAR, http_scan::SCAN_SSE42, http_scan::SCAN_AVX2};
+    for (int impl : impls)
+    {
+        if (!http_scan::select(impl))
+            continue;
+        double base, ns;
+        run(op, np, rounds / 10, base, ns);     // 预热
+        if (!same(op, np))
+        {
+            printf("%s: result differs from old parser\n", http_scan::impl_name());
+            return 1;
+        }
+        run(op, np, rounds, base, ns);
+        printf("%-8s %12.1f %12.1f %10.0f %7.2fx\n", http_scan::impl_name(), base, ns, bytes * 1000 / ns, base / ns);
+    }
+    return 0;
+}
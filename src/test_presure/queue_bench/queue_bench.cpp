@@ -0,0 +1,234 @@
+// 线程池请求队列的吞吐对比: 原来的 std::list + 互斥锁 + 信号量, 无锁环形队列 + 自旋futex信号量, 以及工作窃取队列
+// 用法: ./queue_bench [生产者数] [消费者数] [每个生产者的任务数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <list>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <pthread.h>
+#include "../../lock/locker.h"
+#include "../../lock/mpmc_queue.h"
+#include "../../lock/ws_deque.h"
+
+struct task
+{
+    int id;
+};
+
+// 原来的请求队列
+class list_queue
+{
+public:
+    list_queue(size_t max_request) : m_max_request(max_request) {}
+
+    bool append(task *t)
+    {
+        m_queuelocker.lock();
+        if (m_workqueue.size() >= m_max_request)
+        {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(t);
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+
+    task *take()
+    {
+        while (true)
+        {
+            m_queuestat.wait();
+            m_queuelocker.lock();
+            if (m_workqueue.empty())
+            {
+                m_queuelocker.unlock();
+                continue;
+            }
+            task *t = m_workqueue.front();
+            m_workqueue.pop_front();
+            m_queuelocker.unlock();
+            return t;
+        }
+    }
+
+private:
+    size_t m_max_request;
+    std::list<task *> m_workqueue;
+    locker m_queuelocker;
+    sem m_queuestat;
+};
+
+// 现在的请求队列
+class ring_queue
+{
+public:
+    ring_queue(size_t max_request) : m_workqueue(max_request) {}
+
+    bool append(task *t)
+    {
+        if (!m_workqueue.push(t))
+            return false;
+        m_queuestat.post();
+        return true;
+    }
+
+    task *take()
+    {
+        m_queuestat.wait();
+        task *t;
+        while (!m_workqueue.pop(t))
+            sched_yield();
+        return t;
+    }
+
+private:
+    mpmc_queue<task *> m_workqueue;
+    spin_sem m_queuestat;
+};
+
+// 工作窃取: 每个消费者一个Chase-Lev队列, 生产者轮转放入, 消费者先取自己的再窃取别人的
+class steal_queue
+{
+public:
+    steal_queue(size_t max_request) : m_num(WORKERS), m_next(0), m_seq(0)
+    {
+        for (int i = 0; i < m_num; i++)
+            m_deques[i] = new ws_deque<task *>(max_request / m_num + 1);
+    }
+    ~steal_queue()
+    {
+        for (int i = 0; i < m_num; i++)
+            delete m_deques[i];
+    }
+
+    bool append(task *t)
+    {
+        unsigned first = m_next.fetch_add(1, std::memory_order_relaxed) % m_num;
+        for (int i = 0; i < m_num; i++)
+        {
+            int idx = (first + i) % m_num;
+            m_pushlockers[idx].lock();
+            bool ok = m_deques[idx]->push(t);
+            m_pushlockers[idx].unlock();
+            if (ok)
+            {
+                m_queuestat.post();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    task *take()
+    {
+        static thread_local int id = -1;
+        if (id < 0)
+            id = m_seq++ % m_num;
+
+        m_queuestat.wait();
+        task *t;
+        while (true)
+        {
+            for (int i = 0; i < m_num; i++)
+                if (m_deques[(id + i) % m_num]->steal(t))
+                    return t;
+            sched_yield();
+        }
+    }
+
+    static int WORKERS;
+
+private:
+    int m_num;
+    ws_deque<task *> *m_deques[64];
+    locker m_pushlockers[64];
+    std::atomic<unsigned> m_next;
+    std::atomic<int> m_seq;
+    spin_sem m_queuestat;
+};
+int steal_queue::WORKERS = 8;
+
+template <typename Q>
+struct bench
+{
+    Q *queue;
+    int per_producer;
+    std::atomic<long> consumed;
+};
+
+template <typename Q>
+void *producer(void *arg)
+{
+    bench<Q> *b = (bench<Q> *)arg;
+    static task tasks[1024];
+    for (int i = 0; i < b->per_producer; i++)
+    {
+        task *t = &tasks[i & 1023];
+        while (!b->queue->append(t))    // 队列满时让出CPU再试, 和服务器里满了直接丢弃不同, 这里要统计全部任务
+            sched_yield();
+    }
+    return NULL;
+}
+
+template <typename Q>
+void *consumer(void *arg)
+{
+    bench<Q> *b = (bench<Q> *)arg;
+    while (true)
+    {
+        task *t = b->queue->take();
+        if (!t)     // 结束标记
+            break;
+        b->consumed++;
+    }
+    return NULL;
+}
+
+template <typename Q>
+double run(const char *name, int producers, int consumers, int per_producer)
+{
+    Q queue(10000);
+    bench<Q> b;
+    b.queue = &queue;
+    b.per_producer = per_producer;
+    b.consumed = 0;
+
+    std::vector<pthread_t> ps(producers), cs(consumers);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < consumers; i++)
+        pthread_create(&cs[i], NULL, consumer<Q>, &b);
+    for (int i = 0; i < producers; i++)
+        pthread_create(&ps[i], NULL, producer<Q>, &b);
+    for (int i = 0; i < producers; i++)
+        pthread_join(ps[i], NULL);
+    for (int i = 0; i < consumers; i++)
+        while (!queue.append(NULL))
+            sched_yield();
+    for (int i = 0; i < consumers; i++)
+        pthread_join(cs[i], NULL);
+    auto end = std::chrono::steady_clock::now();
+
+    double sec = std::chrono::duration<double>(end - start).count();
+    long total = (long)producers * per_producer;
+    double mops = total / sec / 1e6;
+    printf("%-12s producers=%d consumers=%d tasks=%ld  %.3fs  %.2f Mops/s%s\n", name, producers, consumers,
+           total, sec, mops, b.consumed == total ? "" : "  (LOST TASKS)");
+    return mops;
+}
+
+int main(int argc, char *argv[])
+{
+    int producers = argc > 1 ? atoi(argv[1]) : 1;
+    int consumers = argc > 2 ? atoi(argv[2]) : 8;
+    int per_producer = argc > 3 ? atoi(argv[3]) : 2000000;
+
+    double a = run<list_queue>("list+mutex", producers, consumers, per_producer);
+    double b = run<ring_queue>("mpmc ring", producers, consumers, per_producer);
+    steal_queue::WORKERS = consumers < 64 ? consumers : 64;
+    double c = run<steal_queue>("work steal", producers, consumers, per_producer);
+    printf("speedup mpmc ring %.2fx, work steal %.2fx\n", b / a, c / a);
+    return 0;
+}
@@ -0,0 +1,196 @@
+// 静态文件发送路径对比: 每次请求mmap + writev(原来的做法), 缓存的映射 + writev, 响应头MSG_MORE + sendfile
+// 通过回环TCP连接发送给一个只读取丢弃的线程, socket非阻塞, EAGAIN时poll等待可写, 与服务器的发送方式一致
+// 用法: ./sendfile_bench [文件大小KB ...] , 默认 4 16 64 256 1024 4096 16384 65536
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <chrono>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+enum MODE
+{
+    MMAP_EACH = 0,  // 每次请求mmap/munmap
+    MMAP_CACHED,    // 映射一次, 多次writev
+    SENDFILE,       // sendfile
+    MODE_NUM
+};
+
+static const char *mode_name[MODE_NUM] = {"mmap each", "mmap cached", "sendfile"};
+
+static const char header[] = "HTTP/1.1 200 OK\r\nContent-Length:0000000000\r\nConnection:keep-alive\r\n\r\n";
+
+static void wait_writable(int fd)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    poll(&pfd, 1, -1);
+}
+
+static void *drain(void *arg)
+{
+    int fd = (int)(long)arg;
+    static char buf[1 << 16];
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    return NULL;
+}
+
+// 发送一个响应: 响应头 + 文件内容
+static bool send_response(int sock, int mode, int file_fd, char *map, size_t size)
+{
+    size_t hlen = sizeof(header) - 1;
+    size_t total = hlen + size;
+    size_t sent = 0;
+
+    char *addr = map;
+    if (mode == MMAP_EACH)
+    {
+        addr = (char *)mmap(0, size, PROT_READ, MAP_PRIVATE, file_fd, 0);
+        if (addr == MAP_FAILED)
+            return false;
+    }
+
+    while (sent < total)
+    {
+        ssize_t n;
+        if (mode == SENDFILE && sent >= hlen)
+        {
+            off_t offset = sent - hlen;
+            n = sendfile(sock, file_fd, &offset, total - sent);
+        }
+        else if (mode == SENDFILE)
+            n = send(sock, header + sent, hlen - sent, MSG_MORE);
+        else
+        {
+            struct iovec iv[2];
+            int count = 0;
+            if (sent < hlen)
+            {
+                iv[count].iov_base = (void *)(header + sent);
+                iv[count++].iov_len = hlen - sent;
+            }
+            size_t off = sent < hlen ? 0 : sent - hlen;
+            iv[count].iov_base = addr + off;
+            iv[count++].iov_len = size - off;
+            n = writev(sock, iv, count);
+        }
+
+        if (n < 0 && errno == EAGAIN)
+        {
+            wait_writable(sock);
+            continue;
+        }
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+
+    if (mode == MMAP_EACH)
+        munmap(addr, size);
+    return true;
+}
+
+static double run(int mode, size_t size, int iterations, int file_fd, char *map)
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    bind(lfd, (struct sockaddr *)&addr, sizeof(addr));
+    listen(lfd, 1);
+    socklen_t len = sizeof(addr);
+    getsockname(lfd, (struct sockaddr *)&addr, &len);
+
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    connect(client, (struct sockaddr *)&addr, sizeof(addr));
+    int sock = accept(lfd, NULL, NULL);
+    close(lfd);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, drain, (void *)(long)client);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        if (!send_response(sock, mode, file_fd, map, size))
+        {
+            printf("send failed: %s\n", strerror(errno));
+            break;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    shutdown(sock, SHUT_WR);
+    pthread_join(tid, NULL);
+    close(sock);
+    close(client);
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+        sizes.push_back((size_t)atol(argv[i]) << 10);
+    if (sizes.empty())
+    {
+        size_t def[] = {4, 16, 64, 256, 1024, 4096, 16384, 65536};
+        for (size_t i = 0; i < sizeof(def) / sizeof(def[0]); i++)
+            sizes.push_back(def[i] << 10);
+    }
+
+    printf("%10s %8s", "size(KB)", "iters");
+    for (int mode = 0; mode < MODE_NUM; mode++)
+        printf(" %14s", mode_name[mode]);
+    printf("   (us/response, MB/s)\n");
+
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        size_t size = sizes[i];
+        char path[] = "/tmp/sendfile_bench_XXXXXX";
+        int fd = mkstemp(path);
+        unlink(path);
+        std::vector<char> data(size, 'x');
+        if (write(fd, data.data(), size) != (ssize_t)size)
+        {
+            printf("write temp file failed\n");
+            return 1;
+        }
+
+        // 每个大小大约发送1GB, 至少20次
+        int iterations = (int)((1ull << 30) / size);
+        if (iterations < 20)
+            iterations = 20;
+        if (iterations > 200000)
+            iterations = 200000;
+
+        char *map = (char *)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        printf("%10zu %8d", size >> 10, iterations);
+        for (int mode = 0; mode < MODE_NUM; mode++)
+        {
+            double secs = run(mode, size, iterations, fd, map);
+            printf(" %6.1f/%7.0f", secs * 1e6 / iterations, (double)size * iterations / secs / (1 << 20));
+            fflush(stdout);
+        }
+        printf("\n");
+        munmap(map, size);
+        close(fd);
+    }
+    return 0;
+}
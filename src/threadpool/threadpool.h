@@ -1,36 +1,157 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <list>
+#include <vector>
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/eventfd.h>
 #include "../lock/locker.h"
+#include "../lock/mpmc_queue.h"
+#include "../lock/ws_deque.h"
+
+// 一个通道在一段统计周期内的指标, 时间单位为微秒
+struct lane_stats
+{
+    int workers;        // 预留给该通道的工作线程数
+    long depth;         // 当前排队的请求数
+    long max_depth;     // 周期内最大排队数
+    long tasks;         // 周期内处理的请求数
+    long avg_wait;      // 平均排队时间
+    long max_wait;      // 最大排队时间
+    long avg_service;   // 平均处理时间
+};
+
+// 完成队列：工作线程放入处理完的请求，队列由空变非空时才写eventfd，多个完成事件合并成一次唤醒；
+// 所属的事件循环把fd()注册到epoll或io_uring，可读时调用pop取走所有请求
+template <typename T>
+class done_queue
+{
+public:
+    done_queue()
+    {
+        m_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_fd < 0)
+            throw std::exception();
+    }
+    ~done_queue() { close(m_fd); }
+
+    int fd() const { return m_fd; }
+
+    void push(T *request)
+    {
+        m_locker.lock();
+        bool was_empty = m_queue.empty();
+        m_queue.push_back(request);
+        m_locker.unlock();
+
+        if (was_empty)
+        {
+            uint64_t one = 1;
+            ::write(m_fd, &one, sizeof(one));
+        }
+    }
+
+    // 先清零eventfd计数再取队列，保证之后放入的请求一定会再次唤醒事件循环
+    void pop(std::vector<T *> &done)
+    {
+        uint64_t cnt;
+        ::read(m_fd, &cnt, sizeof(cnt));
+
+        done.clear();
+        m_locker.lock();
+        done.swap(m_queue);
+        m_locker.unlock();
+    }
+
+private:
+    std::vector<T *> m_queue;
+    locker m_locker;
+    int m_fd;
+};
 
 // 线程池类，将它定义为模板类是为了代码复用，模板参数T是任务类
+// 请求按T::classify()分到不同的通道(静态文件、CGI/数据库、写)，每个通道有自己的队列和预留的工作线程，
+// 数据库请求阻塞时只会占满CGI通道的线程，静态文件请求不用排在它们后面
 template <typename T>
 class threadpool
 {
 private:
+    // 一组工作线程及其队列；线程太少时几个通道共用一组
+    struct lane_group
+    {
+        int first;                  // 本组工作线程编号 [first, first + count)
+        int count;
+        mpmc_queue<T *> *queue;     // 全局队列模式下的请求队列
+        spin_sem queuestat;         // 本组的任务信号量，先自旋再futex睡眠
+        std::atomic<unsigned> next_deque;
+    };
+
+    // 每个通道的统计，工作线程和事件循环并发更新
+    struct lane_counter
+    {
+        std::atomic<long> depth;
+        std::atomic<long> max_depth;
+        std::atomic<long> tasks;
+        std::atomic<long> wait;
+        std::atomic<long> max_wait;
+        std::atomic<long> service;
+    };
+
     int m_thread_num;            // 线程数量
     int m_max_request;           // 请求队列中的最大请求数
     pthread_t *m_threads;        // 线程数组
-    std::list<T *> m_workqueue;  // 请求队列
-    locker m_queuelocker;        // 队列资源的互斥锁
-    sem m_queuestat;             // 队列资源的信号量
-    connection_pool *m_connPool; // 数据库连接池
     int m_actor_model;           // 模式选择
 
+    // 优先级通道
+    lane_group m_groups[T::LANE_NUM];
+    int m_lane_group[T::LANE_NUM];  // 通道 -> 线程组
+    lane_counter m_counters[T::LANE_NUM];
+
+    // 工作窃取调度：每个工作线程一个Chase-Lev队列，事件循环在本组中挑一个较空的放入，空闲线程从组内其他线程的队列窃取
+    int m_work_steal;            // 0 全局请求队列, 1 工作窃取
+    ws_deque<T *> **m_deques;
+    locker *m_pushlockers;       // 多个事件循环(多Reactor)往同一个队列放入时串行化
+    std::atomic<int> m_worker_seq;   // 工作线程启动时领取自己的编号
+
+    // 完成队列：Reactor模式下工作线程读写失败的请求放入，唤醒主线程的epoll_wait，由主线程关闭连接
+    done_queue<T> m_done;
+
     static void *worker(void *arg); // 工作线程所运行的函数，这个函数不断从工作队列中取任务执行
     void run();
+    void push_done(T *request);
+    bool enqueue(T *request, int lane);
+    T *dequeue(lane_group &group, int id);
+    void plan_lanes(int max_request);
+    void finish(int lane, long long start);
+
+    static long long now_us()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
 
 public:
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000) : m_actor_model(actor_model), m_connPool(connPool), m_thread_num(thread_number), m_max_request(max_request), m_threads(nullptr)
+    threadpool(int actor_model, int thread_number = 8, int max_request = 10000, int work_steal = 0) : m_thread_num(thread_number), m_max_request(max_request), m_threads(nullptr), m_actor_model(actor_model), m_work_steal(work_steal), m_deques(nullptr), m_pushlockers(nullptr), m_worker_seq(0)
     {
         // 构造函数完成线程的创建，并把每个子线程分离出去
         if (thread_number <= 0 || max_request <= 0)
             throw std::exception();
 
+        plan_lanes(max_request);
+
+        // 各个工作线程的队列合起来能放下max_request个请求
+        if (m_work_steal)
+        {
+            m_deques = new ws_deque<T *> *[m_thread_num];
+            for (int i = 0; i < m_thread_num; i++)
+                m_deques[i] = new ws_deque<T *>((max_request + m_thread_num - 1) / m_thread_num);
+            m_pushlockers = new locker[m_thread_num];
+        }
+
         m_threads = new pthread_t[m_thread_num];
         if (!m_threads)
             throw std::exception();
@@ -40,13 +161,13 @@ public:
             if (pthread_create(m_threads + i, NULL, worker, this) != 0) // 注意这里把this作为worker的参数传进去了，即用本对象做参数
             {
                 delete[] m_threads;
-                throw std::exception;
+                throw std::exception();
             }
 
             if (pthread_detach(m_threads[i]))
             {
                 delete[] m_threads;
-                throw std::exception;
+                throw std::exception();
             }
         }
     }
@@ -54,46 +175,188 @@ public:
     {
         // 析构时释放资源
         delete[] m_threads;
+        for (int i = 0; m_deques && i < m_thread_num; i++)
+            delete m_deques[i];
+        delete[] m_deques;
+        delete[] m_pushlockers;
+        for (int i = 0; i < T::LANE_NUM; i++)
+            delete m_groups[i].queue;
     }
 
+    // state: 0 Reactor读(还没有数据, 走静态通道), 1 Reactor写(写通道), 2 Reactor已读好待处理(按请求行分类),
+    // 3 io_uring后端已收好待处理(按请求行分类), 只运行状态机, 结果放入请求的m_done_queue
     bool append(T *request, int state);
+    // Proactor: 数据已由事件循环读好, 按请求行分类
     bool append_p(T *request);
+
+    // 主线程把done_fd注册到epoll，可读时调用pop_done取走所有已完成的请求
+    int done_fd() const { return m_done.fd(); }
+    void pop_done(std::vector<T *> &done) { m_done.pop(done); }
+
+    // 取出一个通道上个周期的统计并清零周期计数
+    void get_lane_stats(int lane, lane_stats &stats);
 };
 
 
-// 向队列中添加时，通过互斥锁保证线程安全，添加完成后通过信号量提醒有任务要处理，最后注意线程同步。
-// 向请求队列插入一个特定state的请求，唤醒正在等待队列的线程
+// 划分通道: CGI通道预留约1/4的线程; Reactor模式下写通道预留约1/8; 其余给静态通道.
+// 线程数不够预留时, 该通道并入静态通道的线程组(统计仍然分开).
+// 非阻塞的写不会占住CPU等待, 单核时单独的写线程只会多出线程切换, 不预留
 template <typename T>
-bool threadpool<T>::append(T *request, int state)
+void threadpool<T>::plan_lanes(int max_request)
 {
-    m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_request) // 请求数已满，请求失败，注意返回前要记得解锁mutex即locker
+    int reserved[T::LANE_NUM] = {0};
+    reserved[T::LANE_CGI] = m_thread_num >= 2 ? (m_thread_num / 4 > 0 ? m_thread_num / 4 : 1) : 0;
+    if (m_actor_model == 1 && m_thread_num - reserved[T::LANE_CGI] >= 2 && sysconf(_SC_NPROCESSORS_ONLN) > 1)
+        reserved[T::LANE_WRITE] = m_thread_num / 8 > 0 ? m_thread_num / 8 : 1;
+    reserved[T::LANE_STATIC] = m_thread_num - reserved[T::LANE_CGI] - reserved[T::LANE_WRITE];
+
+    int first = 0;
+    for (int lane = 0; lane < T::LANE_NUM; lane++)
+    {
+        lane_group &group = m_groups[lane];
+        group.first = first;
+        group.count = reserved[lane];
+        group.queue = NULL;
+        group.next_deque = 0;
+        first += reserved[lane];
+
+        m_lane_group[lane] = reserved[lane] > 0 ? lane : (int)T::LANE_STATIC;
+        if (reserved[lane] > 0 && !m_work_steal)
+            group.queue = new mpmc_queue<T *>(max_request);
+
+        lane_counter &c = m_counters[lane];
+        c.depth = c.max_depth = c.tasks = c.wait = c.max_wait = c.service = 0;
+    }
+}
+
+// 放入通道: 全局队列直接放入; 工作窃取时从本组轮转到的两个队列中选较空的放入, 都满了再依次尝试组内其余队列
+template <typename T>
+bool threadpool<T>::enqueue(T *request, int lane)
+{
+    lane_group &group = m_groups[m_lane_group[lane]];
+    request->m_lane = lane;
+    request->m_queue_time = now_us();
+    // 任务持有请求的一个引用, 放入队列之前取得, 处理完由工作线程放掉; 连接在此期间关闭时对象不会被回收
+    request->hold();
+
+    bool ok = false;
+    if (!m_work_steal)
+        ok = group.queue->push(request);
+    else
+    {
+        unsigned first = group.next_deque.fetch_add(1, std::memory_order_relaxed) % group.count;
+        unsigned second = (first + 1) % group.count;
+        if (m_deques[group.first + second]->size() < m_deques[group.first + first]->size())
+            first = second;
+
+        for (int i = 0; i < group.count && !ok; i++)
+        {
+            int idx = group.first + (first + i) % group.count;
+            m_pushlockers[idx].lock();
+            ok = m_deques[idx]->push(request);
+            m_pushlockers[idx].unlock();
+        }
+    }
+    if (!ok)
     {
-        m_queuelocker.unlock();
+        request->release();
         return false;
     }
-    request->m_state = state;       // 设置请求的state
-    m_workqueue.push_back(request); // 向请求队列插入一个请求
-    m_queuelocker.unlock();
 
-    m_queuestat.post(); // 唤醒正在等待队列的线程
+    lane_counter &c = m_counters[lane];
+    long depth = ++c.depth;
+    long max = c.max_depth.load(std::memory_order_relaxed);
+    while (depth > max && !c.max_depth.compare_exchange_weak(max, depth))
+        ;
+
+    group.queuestat.post(); // 唤醒正在等待本组队列的线程
     return true;
 }
 
+// 取出请求: 拿到信号量就一定有一个请求属于本线程, 但它可能在组内任何一个队列里,
+// 也可能还在被生产者写入; 先取自己的队列, 再从组内其他线程的队列窃取, 都没有就让出CPU再试
 template <typename T>
-bool threadpool<T>::append_p(T *request)
+T *threadpool<T>::dequeue(lane_group &group, int id)
 {
-    m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_request) // 请求数已满，请求失败，注意返回前要记得解锁mutex即locker
+    T *request;
+    while (true)
     {
-        m_queuelocker.unlock();
-        return false;
+        if (!m_work_steal)
+        {
+            if (group.queue->pop(request))
+                break;
+        }
+        else
+        {
+            bool found = false;
+            for (int i = 0; i < group.count && !found; i++)
+                found = m_deques[group.first + (id - group.first + i) % group.count]->steal(request);
+            if (found)
+                break;
+        }
+        sched_yield();
     }
-    m_workqueue.push_back(request); // 向请求队列插入一个请求
-    m_queuelocker.unlock();
 
-    m_queuestat.post(); // 唤醒正在等待队列的线程
-    return true;
+    // 排队时间
+    lane_counter &c = m_counters[request->m_lane];
+    c.depth--;
+    long wait = now_us() - request->m_queue_time;
+    c.wait += wait;
+    long max = c.max_wait.load(std::memory_order_relaxed);
+    while (wait > max && !c.max_wait.compare_exchange_weak(max, wait))
+        ;
+    return request;
+}
+
+// 处理时间; 只用调用者保存的通道, 请求重新注册事件后可能已属于其他线程
+template <typename T>
+void threadpool<T>::finish(int lane, long long start)
+{
+    lane_counter &c = m_counters[lane];
+    c.tasks++;
+    c.service += now_us() - start;
+}
+
+template <typename T>
+void threadpool<T>::get_lane_stats(int lane, lane_stats &stats)
+{
+    lane_counter &c = m_counters[lane];
+    stats.workers = m_lane_group[lane] == lane ? m_groups[lane].count : 0;
+    stats.depth = c.depth;
+    stats.max_depth = c.max_depth.exchange(c.depth);
+    stats.tasks = c.tasks.exchange(0);
+    long wait = c.wait.exchange(0);
+    long service = c.service.exchange(0);
+    stats.max_wait = c.max_wait.exchange(0);
+    stats.avg_wait = stats.tasks ? wait / stats.tasks : 0;
+    stats.avg_service = stats.tasks ? service / stats.tasks : 0;
+}
+
+// 向请求队列插入一个特定state的请求，唤醒正在等待队列的线程
+template <typename T>
+bool threadpool<T>::append(T *request, int state)
+{
+    int lane = T::LANE_STATIC;
+    if (state == 1)
+        lane = T::LANE_WRITE;
+    else if (state >= 2)
+        lane = request->classify();
+
+    request->m_state = state;           // 设置请求的state
+    return enqueue(request, lane);      // 请求数已满时失败
+}
+
+template <typename T>
+bool threadpool<T>::append_p(T *request)
+{
+    return enqueue(request, request->classify());
+}
+
+// 工作线程报告一个请求读写失败
+template <typename T>
+void threadpool<T>::push_done(T *request)
+{
+    m_done.push(request);
 }
 
 // 因为pthread_create指定的函数格式和C++中this指针的矛盾，要把传给线程的函数声明为 static 静态成员函数：这里是worker函数
@@ -111,64 +374,101 @@ void *threadpool<T>::worker(void *arg)
 template <typename T>
 void threadpool<T>::run()   
 {
-    // 不断循环获取请求并进行处理
+    // 本线程的编号和所属的线程组
+    int id = m_worker_seq.fetch_add(1) % m_thread_num;
+    int g = 0;
+    while (g + 1 < T::LANE_NUM && id >= m_groups[g].first + m_groups[g].count)
+        g++;
+    lane_group &group = m_groups[g];
+
+    // 不断循环获取请求并进行处理.
+    // process()和write()中重新注册EPOLLONESHOT后, 连接可能马上又被事件循环交给其他线程,
+    // 之后只能用局部变量做统计, 最后放掉任务的引用; 需要访问请求的记录都在重新注册之前做完
     while (true)
     {
-        m_queuestat.wait(); // 等待请求队列资源，即 P 操作
+        group.queuestat.wait(); // 等待请求队列资源，即 P 操作
 
-        m_queuelocker.lock();    // 被唤醒后，要操作请求队列这个共享资源时得上锁
-        
-        if (m_workqueue.empty()) // 没抢到，没任务了，解锁后接着循环等(阻塞)
+        T *request = dequeue(group, id);
+        long long start = now_us();
+        int lane = request->m_lane;
+
+        // io_uring后端: 只运行状态机, 由所属的事件循环从完成队列取走结果后提交writev;
+        // 任务的引用随请求放入完成队列, 由事件循环放掉
+        if (request->m_state == 3)
         {
-            m_queuelocker.unlock();
+            request->m_result = request->process_uring();
+            finish(lane, start);
+            request->m_done_queue->push(request);
             continue;
         }
-        else // 抢到了，获取请求队列的首个任务
-        {
-            T *request = m_workqueue.front();
-            m_workqueue.pop_front();
-            m_queuelocker.unlock(); // 解锁
 
-            if (!request) // 空任务，continue
-                continue;
-
-            // 线程池创建时所设置的运行模式，对应有不同的处理
-            if (m_actor_model == 1) // 1模式 Reactor，子线程需要自己从socket读取数据或者写入数据到socket
+        // 线程池创建时所设置的运行模式，对应有不同的处理
+        if (m_actor_model == 1) // 1模式 Reactor，子线程需要自己从socket读取数据或者写入数据到socket
+        {
+            // 读写失败时没有重新注册事件, 置timer_flag放入完成队列, 由主线程收到通知后关闭连接
+            bool failed = false;
+            if (request->m_state == 0) // 0请求类型 即 读
             {
-                if (request->m_state == 0) // 0请求类型 即 读
+                if (request->read_once()) // read_once，socket缓冲区内容读到连接对象读缓冲中
                 {
-                    if (request->read_once()) // read_once，socket缓冲区内容读到连接对象读缓冲中
+                    // 读到请求行后才知道请求属于哪个通道, 不属于本组的交给对应通道的线程处理
+                    int to = request->classify();
+                    if (m_lane_group[to] != g)
                     {
-                        request->improv = 1;
-                        connectionRAII mysqlcon(&request->mysql, m_connPool);
-                        request->process();
-                    }
-                    else
-                    {
-                        request->improv = 1;
-                        request->timer_flag = 1;
+                        finish(lane, start);
+                        if (append(request, 2))
+                        {
+                            request->release();     // 新任务已持有引用
+                            continue;
+                        }
+                        start = now_us();   // 对应通道已满, 在本线程处理
                     }
+                    request->m_lane = lane = to;
+                    request->process();
                 }
-                else                       // 1请求类型 即 写
+                else
                 {
-                    if(request->write())    // write
-                    {
-                        request->improv = 1;
-                    }
-                    else
+                    failed = true;
+                }
+            }
+            else if (request->m_state == 2) // 2请求类型 即 已读好, 由CGI等通道处理
+            {
+                request->process();
+            }
+            else                       // 1请求类型 即 写
+            {
+                // 没发完时连接已重新注册写事件, 可能已被分给其他线程, 只能根据write的结果判断
+                bool pipelined;
+                if (!request->write(&pipelined))  // write
+                {
+                    failed = true;
+                }
+                else if (pipelined)
+                {
+                    // 流水线: 发送期间已收到后续请求, 交给对应通道处理; 这时还没有重新注册事件
+                    finish(lane, start);
+                    if (append(request, 2))
                     {
-                        request->improv = 1;
-                        request->timer_flag = 1;
+                        request->release();
+                        continue;
                     }
+                    start = now_us();
+                    lane = request->m_lane;
+                    request->process();
                 }
             }
-            else // 0模式   Proactor
+            if (failed)
             {
-                connectionRAII mysqlcon(&request->mysql, m_connPool);
-                request->process();
+                request->timer_flag = 1;
+                push_done(request);
             }
         }
-
+        else // 0模式   Proactor
+        {
+            request->process();
+        }
+        finish(lane, start);
+        request->release();
     }
 }
 
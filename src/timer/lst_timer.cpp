@@ -1,189 +1,240 @@
 #include "lst_timer.h"
 #include "../httprequest/http_conn.h"
+#include "../webserver/conn_slab.h"
 
-// 定时器回调函数
+// 定时器回调函数: 事件循环关闭连接
 void cb_func(client_data *user_data)
 {
-    // 删除非活动连接在socket上的注册事件
-    epoll_ctl(Utils::u_epollfd,EPOLL_CTL_DEL,user_data->sockfd,0);
     assert(user_data);
-    // 关闭socketfd
-    close(user_data->sockfd);
+    // 删除非活动连接在socket上的注册事件
+    epoll_ctl(user_data->epollfd,EPOLL_CTL_DEL,user_data->sockfd,0);
+    // io_uring后端的连接上挂着多路recv, 内核持有socket的引用, 需先shutdown让recv结束
+    if (user_data->epollfd == -1)
+        shutdown(user_data->sockfd, SHUT_RDWR);
     http_conn::m_user_count--;
+    // 定时器已从时间轮中取下, 置空表示连接已关闭, 连接状态归还之前事件循环忽略它的事件
+    user_data->timer = NULL;
+    // 放掉事件循环的引用, 没有工作线程或在途的writev使用连接时, 从连接表中去掉连接状态后关闭socket,
+    // 之后不能再访问user_data; fd关闭之前不会被其他事件循环accept到
+    conn_slab::get_instance()->get(user_data->sockfd)->conn.release();
 }
 
 
-void sort_timer_lst::add_timer(util_timer *timer)
+time_wheel::time_wheel()
 {
-    if(!timer)
-        return ;
+    m_cur = get_time_ms();
+    m_count = 0;
+    memset(m_slots, 0, sizeof(m_slots));
+    memset(m_bitmap, 0, sizeof(m_bitmap));
+}
 
-    // 空链表
-    if(!head) 
+// 按超时时间与当前时间的距离选择层和槽
+void time_wheel::link(util_timer *timer)
+{
+    long long expire = timer->expire;
+    long long idx = expire - m_cur;
+    int level = 0, slot;
+
+    if (idx < 0)                        // 已经超时, 放到马上要处理的槽
+        slot = m_cur & (TW_SIZE0 - 1);
+    else if (idx < TW_SIZE0)
+        slot = expire & (TW_SIZE0 - 1);
+    else
     {
-        head = tail = timer;
-        return;
+        // 超出最高层范围的放在最高层, 级联时再重新放置
+        long long max_idx = 1LL << shift(TW_LEVELS);
+        if (idx >= max_idx)
+        {
+            expire = m_cur + max_idx - 1;
+            idx = max_idx - 1;
+        }
+        level = 1;
+        while (idx >= (1LL << shift(level + 1)))
+            level++;
+        slot = (expire >> shift(level)) & (TW_SIZE - 1);
     }
 
-    // 放队首的情况
-    if(timer->expire < head->expire) 
-    {
-        timer->next = head;
+    util_timer *&head = m_slots[level][slot];
+    timer->prev = NULL;
+    timer->next = head;
+    if (head)
         head->prev = timer;
-        head = timer;
-        return;
-    }
-
-    // 其他情况
-    add_timer(timer,head);
+    head = timer;
+    timer->slot = level * TW_SIZE0 + slot;
+    m_bitmap[level][slot / 64] |= 1ULL << (slot % 64);
 }
 
-void sort_timer_lst::add_timer( util_timer*timer, util_timer *lst_head)
+void time_wheel::unlink(util_timer *timer)
 {
-    util_timer *prev = lst_head;
-    util_timer *tmp = prev->next;
+    int level = timer->slot / TW_SIZE0;
+    int slot = timer->slot % TW_SIZE0;
 
-    while(tmp)
-    {   
-        // 寻找适合的位置插入
-        if(timer->expire < tmp->expire)
-        {
-            prev->next = timer;
-            timer->next = tmp;
-            tmp->prev = timer;
-            timer->prev = prev;
-            break;
-        }
-        prev = tmp;
-        tmp = tmp->next;
-    }
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else
+        m_slots[level][slot] = timer->next;
+    if (timer->next)
+        timer->next->prev = timer->prev;
+    if (!m_slots[level][slot])
+        m_bitmap[level][slot / 64] &= ~(1ULL << (slot % 64));
 
-    // 放队尾的情况
-    if(!tmp)
-    {
-        prev->next=timer;
-        timer->next=nullptr;
-        timer->prev=prev;
-        tail = timer;
-    }
+    timer->slot = -1;
+    timer->prev = timer->next = NULL;
 }
 
-void sort_timer_lst::adjust_timer(util_timer* timer)
+void time_wheel::add_timer(util_timer *timer)
 {
-    if(!timer)
+    if (!timer)
         return;
 
-    util_timer *tmp = timer->next;
-    // timer处在队尾 或 timer的超时时间小于下一个timer，不用改变位置
-    if(!tmp || (timer->expire<tmp->expire))
-    {
-        return ;
-    }
-
-    // 需要改变位置：先取出timer，再重新放回去
-    if(timer == head)   // 处于队头
-    {
-        head = head->next;      // 更新队头
-        head->prev = nullptr;   
-        timer->next = nullptr;
-        add_timer(timer, head);
-    }
-    else                // 中间位置
+    // fd被复用而旧连接的定时器还在时间轮中(连接在别处被直接关闭), 按新的超时时间重新放置
+    if (timer->slot != -1)
     {
-        timer->prev->next = timer->next;
-        timer->next->prev = timer->prev;
-        add_timer(timer,timer->next);
+        adjust_timer(timer);
+        return;
     }
 
+    // 时间轮为空时m_cur可能已落后很久, 直接对齐到当前时间
+    if (m_count == 0)
+        m_cur = get_time_ms();
+    link(timer);
+    m_count++;
 }
 
-void sort_timer_lst::del_timer(util_timer *timer)
+void time_wheel::adjust_timer(util_timer *timer)
 {
-    if(!timer)
+    if (!timer || timer->slot == -1)
         return;
-    
-    if((timer == head)&&(timer==tail))
-    {
-        delete timer;
-        head=nullptr;
-        tail=nullptr;
+
+    unlink(timer);
+    link(timer);
+}
+
+void time_wheel::del_timer(util_timer *timer)
+{
+    if (!timer || timer->slot == -1)
         return;
-    }
 
-    if(timer == head)
+    unlink(timer);
+    m_count--;
+}
+
+// 把第level层当前槽的定时器整体取下, 按剩余时间重新放到低层; 这一层也转完一圈时继续级联上一层
+void time_wheel::cascade(int level)
+{
+    int slot = (m_cur >> shift(level)) & (TW_SIZE - 1);
+
+    util_timer *timer = m_slots[level][slot];
+    m_slots[level][slot] = NULL;
+    m_bitmap[level][0] &= ~(1ULL << slot);
+    while (timer)
     {
-        head=head->next;
-        head->prev=nullptr;
-        delete timer;
-        return;
+        util_timer *next = timer->next;
+        link(timer);
+        timer = next;
     }
 
-    if(timer == tail)
+    if (slot == 0 && level + 1 < TW_LEVELS)
+        cascade(level + 1);
+}
+
+int time_wheel::find_slot0(int idx) const
+{
+    for (int w = idx / 64; w < TW_SIZE0 / 64; w++)
     {
-        tail=tail->prev;
-        tail->next=nullptr;
-        delete timer;
-        return;
+        uint64_t bits = m_bitmap[0][w];
+        if (w == idx / 64)
+            bits &= ~0ULL << (idx % 64);
+        if (bits)
+            return w * 64 + __builtin_ctzll(bits);
     }
-
-    timer->prev->next=timer->next;
-    timer->next->prev=timer->prev;
-    delete timer;
+    return -1;
 }
 
-void sort_timer_lst::tick()
+void time_wheel::tick()
 {
-    if(!head)
-        return ;
-    
     // 当前时间
-    time_t cur = time(NULL);
+    long long now = get_time_ms();
 
-    util_timer *tmp = head;
-    while(tmp)
+    while (m_cur <= now)
     {
-        if(cur<tmp->expire)
+        if (m_count == 0)
         {
+            m_cur = now + 1;
             break;
         }
-        // 调用回调函数关闭连接
-        tmp->cb_func(tmp->user_data);
-        // 删除定时器
-        head = tmp->next;
-        if(head)
-            head->prev = nullptr;
-        delete tmp;
-        
-        tmp=head;
-    }
 
-}
+        int idx = m_cur & (TW_SIZE0 - 1);
+        // 第0层转完一圈, 从上一层取下一批定时器
+        if (idx == 0)
+            cascade(1);
 
+        // 调用回调函数关闭连接, 并取下定时器
+        util_timer *timer;
+        while ((timer = m_slots[0][idx]) != NULL)
+        {
+            del_timer(timer);
+            timer->cb_func(timer->user_data);
+        }
 
-int *Utils::u_pipefd = 0;
-int Utils::u_epollfd = 0;
+        // 跳过空槽: 直接走到下一个非空槽或第0层的下一圈, 但不超过当前时间,
+        // 否则之后加入的定时器会被放到跳过的位置之后
+        long long next = (m_cur | (TW_SIZE0 - 1)) + 1;
+        int slot = idx + 1 < TW_SIZE0 ? find_slot0(idx + 1) : -1;
+        if (slot > idx)
+            next = m_cur + (slot - idx);
+        m_cur = next < now + 1 ? next : now + 1;
+    }
+}
 
-void Utils::init(int timeslot)
+// 循环右移, 让第level层要查找的第一个槽落在第0位
+static inline uint64_t rotate_right(uint64_t bits, int n)
 {
-    m_TIMESLOT = timeslot;
+    n &= 63;
+    return n ? (bits >> n) | (bits << (64 - n)) : bits;
 }
 
-// 信号处理函数中仅仅通过管道发送信号值，不处理信号对应的逻辑，缩短异步执行时间，减少对主程序的影响。
-void  Utils::sig_handler(int sig)
+long long time_wheel::next_expire() const
 {
-    // 为保证信号处理函数的可重入性，保留原来的errno
-    int save_errno = errno;
-    int msg = sig;
-    
-    // 将信号值从管道写端写入，传输字符类型，而非整型
-    send(u_pipefd[1], (char *)&msg, 1, 0);
+    if (m_count == 0)
+        return -1;
+
+    // 第0层本圈内的非空槽就是准确的超时时间; 只剩下一圈的定时器时, 最晚在下一圈开始时处理
+    long long best = -1;
+    int idx = m_cur & (TW_SIZE0 - 1);
+    int slot = find_slot0(idx);
+    if (slot >= 0)
+        best = m_cur + (slot - idx);
+    else if (find_slot0(0) >= 0)
+        best = (m_cur | (TW_SIZE0 - 1)) + 1;
+
+    // 高层的定时器在所在槽级联时才能确定准确时间, 以级联时间为准;
+    // m_cur正好在本层的边界上时, 当前槽还没有级联
+    for (int level = 1; level < TW_LEVELS; level++)
+    {
+        uint64_t bits = m_bitmap[level][0];
+        if (!bits)
+            continue;
+        long long cur = m_cur >> shift(level);
+        int start = (m_cur & ((1LL << shift(level)) - 1)) ? 1 : 0;
+        int d = __builtin_ctzll(rotate_right(bits, (int)((cur + start) & (TW_SIZE - 1)))) + start;
+        long long t = (cur + d) << shift(level);
+        if (best == -1 || t < best)
+            best = t;
+    }
+    return best;
+}
 
-    // 将原来的errno赋值给当前的errno
-    errno = save_errno;
+
+void Utils::init(int timeslot)
+{
+    m_TIMESLOT = timeslot;
+    m_timerfd = -1;
+    m_timer_armed = 0;
 }
 
 // 注册信号sig的处理函数
-void Utils::addsig(int sig, void(handler)(int),bool restart = true)
+void Utils::addsig(int sig, void(handler)(int), bool restart)
 {
     // 创建sigaction结构体变量
     struct sigaction sa;
@@ -202,10 +253,51 @@ void Utils::addsig(int sig, void(handler)(int),bool restart = true)
 }
 
 
+int Utils::init_timerfd()
+{
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    m_timer_armed = 0;
+    return m_timerfd;
+}
+
+// 设置timerfd在单调时钟的expire毫秒到期, expire为-1时取消
+void Utils::arm_timerfd(long long expire)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (expire > 0)
+    {
+        its.it_value.tv_sec = expire / 1000;
+        its.it_value.tv_nsec = (expire % 1000) * 1000000;
+    }
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    m_timer_armed = expire > 0 ? expire : 0;
+}
+
 void Utils::timer_handler()
 {
-    m_timer_lst.tick();
-    alarm(m_TIMESLOT);
+    uint64_t expirations;
+    read(m_timerfd, &expirations, sizeof(expirations));
+
+    m_time_wheel.tick();
+    arm_timerfd(m_time_wheel.next_expire());
+}
+
+// 定时器只会往后调整, 时间轮的下一个到期时间不会因此提前, 到期后再重新设置;
+// 所以只有新定时器使到期时间提前(或timerfd未设置)时才需要调用timerfd_settime
+void Utils::update_timerfd()
+{
+    long long expire = m_time_wheel.next_expire();
+    if (expire > 0 && (m_timer_armed == 0 || expire < m_timer_armed))
+        arm_timerfd(expire);
+}
+
+void Utils::wakeup_timerfd()
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = 1;
+    timerfd_settime(m_timerfd, 0, &its, NULL);
 }
 
 // 客户端连接已满的时候,发回 busy 消息并关闭
@@ -20,65 +20,91 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <stdint.h>
 
 #include <time.h>
 #include "../log/log.h"
 
-class util_timer;
+struct client_data;
 
-// 连接资源结构体：sockfd，sockaddress，timer
-struct client_data
+// 单调时钟的当前毫秒数, 定时器的超时时间都以它为准, 不受系统改时间影响
+inline long long get_time_ms()
 {
-    sockaddr_in address;    
-    int sockfd;
-    util_timer *timer;
-};
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-// 定时器结点
+// 定时器结点, 内嵌在client_data中, 不单独new/delete
 class util_timer
 {
 public:
-    util_timer(): prev(NULL), next(NULL) {}
+    util_timer(): slot(-1), prev(NULL), next(NULL) {}
 
 public:
-    time_t expire;      // 超时时间
+    long long expire;   // 超时时间, 单调时钟毫秒
 
     //  超时回调函数，类型为函数指针
     void (*cb_func)(client_data *);
 
     client_data *user_data;
+    int slot;           // 所在时间轮的槽位(层*TW_SIZE0+槽), -1表示不在时间轮中
     util_timer *prev;
     util_timer *next;
 };
 
-// 用 双向升序链表 来组织定时器
-class sort_timer_lst
+// 连接资源结构体：sockfd，sockaddress，所属epoll，timer
+struct client_data
+{
+    sockaddr_in address;    
+    int sockfd;
+    int epollfd;
+    util_timer *timer;      // 连接在时间轮中时指向timer_node, 关闭后为NULL
+    util_timer timer_node;
+};
+
+// 分层时间轮: 第0层256个槽, 每槽1ms; 第1~3层各64个槽, 每槽是下一层一整圈.
+// 定时器按超时时间放入对应层的槽中, 高层的槽转到时整体降到低层(级联).
+// 插入、刷新、删除都是O(1), 不随连接数增长
+class time_wheel
 {
 public:
-    sort_timer_lst(): head(nullptr),tail(nullptr) {}
-    ~sort_timer_lst()
-    {
-        util_timer* tmp = head;
-        while(tmp) 
-        {
-            head = tmp->next;
-            delete tmp;
-            tmp = head;
-        }
-    }
+    time_wheel();
+    ~time_wheel() {}
 
     void add_timer(util_timer *timer);
+    // 超时时间改变后重新放置
     void adjust_timer(util_timer *timer);
+    // 从时间轮中取下, 结点本身属于client_data, 不释放
     void del_timer(util_timer *timer);
 
-    // 关闭所有超时连接, 并删除链表中的定时器
-    void tick();        
+    // 关闭所有超时连接, 并从时间轮中取下它们的定时器
+    void tick();
 
-private:
-    void add_timer(util_timer *timer, util_timer *lst_head);
+    // timerfd应当到期的时间: 最早的超时时间或下一次级联的时间(不晚于最早的超时时间), 为空时返回-1
+    long long next_expire() const;
 
-    util_timer *head;
-    util_timer *tail;
+private:
+    static const int TW_LEVELS = 4;
+    static const int TW_BITS0 = 8;
+    static const int TW_BITS = 6;
+    static const int TW_SIZE0 = 1 << TW_BITS0;
+    static const int TW_SIZE = 1 << TW_BITS;
+
+    // 第level层每个槽代表的时间跨度(ms)取对数
+    static int shift(int level) { return level == 0 ? 0 : TW_BITS0 + (level - 1) * TW_BITS; }
+
+    void link(util_timer *timer);
+    void unlink(util_timer *timer);
+    void cascade(int level);
+    // 第0层从idx开始的第一个非空槽, 没有返回-1
+    int find_slot0(int idx) const;
+
+    long long m_cur;    // 下一个要处理的毫秒
+    int m_count;        // 时间轮中的定时器数量
+    util_timer *m_slots[TW_LEVELS][TW_SIZE0];
+    uint64_t m_bitmap[TW_LEVELS][TW_SIZE0 / 64];    // 非空槽的位图
 };
 
 
@@ -97,22 +123,31 @@ public:
     // 将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
     void addfd(int epollfd, int fd, bool one_shot, int TRIGMode);
 
-    // 信号处理函数
-    static void sig_handler(int sig);
-
     // 设置信号函数
     void addsig(int sig, void(handler)(int), bool restart = true);
 
-    // 定时处理任务，重新定时以不断触发SIGALRM信号
+    // 创建timerfd, 由事件循环和其他fd一起监听
+    int init_timerfd();
+
+    // timerfd到期: 处理超时连接, 再按时间轮的下一个到期时间重新设置timerfd
     void timer_handler();
 
+    // 新加入的定时器早于timerfd当前的到期时间时, 把timerfd提前
+    void update_timerfd();
+
+    // 让timerfd立即到期, 用来从其他线程唤醒事件循环
+    void wakeup_timerfd();
+
     void show_error(int connfd, const char *info);
 
 public:
-    static int *u_pipefd;           // 匿名管道fd
-    sort_timer_lst m_timer_lst;     // 计时器链表
-    static int u_epollfd;           // epollfd
+    time_wheel m_time_wheel;        // 时间轮
     int m_TIMESLOT;                 // 定时任务时间间隔
+    int m_timerfd;                  // 按时间轮下一个到期时间设置的timerfd
+    long long m_timer_armed;        // timerfd当前的到期时间, 0表示未设置
+
+private:
+    void arm_timerfd(long long expire);
 };
 
 // 超时回调函数
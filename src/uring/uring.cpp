@@ -0,0 +1,249 @@
+#include "uring.h"
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+uring::uring()
+{
+    m_ring_fd = -1;
+    m_sq_ptr = MAP_FAILED;
+    m_cq_ptr = MAP_FAILED;
+    m_sqes = (io_uring_sqe *)MAP_FAILED;
+    m_buf_ring = (io_uring_buf_ring *)MAP_FAILED;
+    m_bufs = NULL;
+    m_sqe_head = m_sqe_tail = 0;
+    m_buf_tail = 0;
+}
+
+uring::~uring()
+{
+    if (m_bufs)
+        free(m_bufs);
+    if (m_buf_ring != MAP_FAILED)
+        munmap(m_buf_ring, m_buf_ring_size);
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sqes_size);
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_size);
+    if (m_sq_ptr != MAP_FAILED)
+        munmap(m_sq_ptr, m_sq_size);
+    if (m_ring_fd != -1)
+        close(m_ring_fd);
+}
+
+bool uring::init(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // 一个ring只由一个事件循环线程使用
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    m_ring_fd = io_uring_setup(entries, &p);
+    if (m_ring_fd < 0)
+    {
+        // 老内核不支持上面的标志, 退回默认
+        memset(&p, 0, sizeof(p));
+        m_ring_fd = io_uring_setup(entries, &p);
+        if (m_ring_fd < 0)
+            return false;
+    }
+
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (m_cq_size > m_sq_size)
+            m_sq_size = m_cq_size;
+        m_cq_size = m_sq_size;
+    }
+
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+        return false;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        m_cq_ptr = m_sq_ptr;
+    else
+    {
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+            return false;
+    }
+
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *)mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+        return false;
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    m_sqe_head = m_sqe_tail = *m_sq_tail;
+    return true;
+}
+
+bool uring::setup_buf_ring(unsigned short bgid, unsigned entries, unsigned buf_size)
+{
+    // entries 必须是2的幂
+    m_buf_entries = entries;
+    m_buf_size = buf_size;
+    m_buf_ring_size = entries * sizeof(io_uring_buf);
+    m_buf_ring = (io_uring_buf_ring *)mmap(0, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_buf_ring == MAP_FAILED)
+        return false;
+    memset(m_buf_ring, 0, m_buf_ring_size);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)m_buf_ring;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (io_uring_register(m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return false;
+
+    m_bufs = (char *)malloc((size_t)entries * buf_size);
+    if (!m_bufs)
+        return false;
+
+    // 所有缓冲区一开始都交给内核
+    m_buf_tail = 0;
+    for (unsigned i = 0; i < entries; i++)
+        recycle_buf(i);
+    return true;
+}
+
+void uring::recycle_buf(unsigned short bid)
+{
+    // C++下内核头文件里bufs前的空结构体占1字节, bufs的偏移不对, 直接按数组访问
+    io_uring_buf *buf = (io_uring_buf *)m_buf_ring + (m_buf_tail & (m_buf_entries - 1));
+    buf->addr = (uint64_t)(uintptr_t)buf_addr(bid);
+    buf->len = m_buf_size;
+    buf->bid = bid;
+    m_buf_tail++;
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
+
+io_uring_sqe *uring::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sqe_tail - head >= *m_sq_mask + 1)
+    {
+        // SQ满了, 先交给内核
+        flush_sq();
+        io_uring_enter(m_ring_fd, m_sqe_tail - m_sqe_head, 0, 0);
+        m_sqe_head = m_sqe_tail;
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sqe_tail - head >= *m_sq_mask + 1)
+            return NULL;
+    }
+
+    io_uring_sqe *sqe = &m_sqes[m_sqe_tail & *m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqe_tail++;
+    return sqe;
+}
+
+// 把本地填好的SQE发布到SQ数组, 返回待提交的数量
+int uring::flush_sq()
+{
+    unsigned tail = *m_sq_tail;
+    for (unsigned i = m_sqe_head; i != m_sqe_tail; i++)
+    {
+        m_sq_array[tail & *m_sq_mask] = i & *m_sq_mask;
+        tail++;
+    }
+    __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+    return m_sqe_tail - m_sqe_head;
+}
+
+int uring::submit_and_wait(unsigned wait_nr)
+{
+    int to_submit = flush_sq();
+    m_sqe_head = m_sqe_tail;
+    return io_uring_enter(m_ring_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+io_uring_cqe *uring::peek_cqe()
+{
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &m_cqes[head & *m_cq_mask];
+}
+
+void uring::cqe_seen()
+{
+    __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool uring::prep_accept_multishot(int fd, uint64_t user_data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool uring::prep_recv_multishot(int fd, unsigned short bgid, uint64_t user_data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool uring::prep_writev(int fd, const struct iovec *iov, int iov_count, uint64_t user_data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iov_count;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool uring::prep_poll_multishot(int fd, unsigned poll_mask, uint64_t user_data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = poll_mask;
+    sqe->user_data = user_data;
+    return true;
+}
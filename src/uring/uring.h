@@ -0,0 +1,81 @@
+#ifndef URING_H
+#define URING_H
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// io_uring 的最小封装, 直接使用系统调用, 不依赖liburing
+// 只提供服务器用到的几种操作: 多路accept、带提供缓冲区的多路recv、writev、多路poll
+class uring
+{
+public:
+    uring();
+    ~uring();
+
+    // 创建ring并映射SQ/CQ, entries为SQ大小
+    bool init(unsigned entries);
+
+    // 注册提供缓冲区环(provided buffer ring), 多路recv从这里取缓冲区
+    bool setup_buf_ring(unsigned short bgid, unsigned entries, unsigned buf_size);
+    char *buf_addr(unsigned short bid) { return m_bufs + (size_t)bid * m_buf_size; }
+    // 缓冲区用完后还给内核
+    void recycle_buf(unsigned short bid);
+
+    // 取一个空闲的SQE, SQ满时先提交; 提交后仍然满(内核还没取走, 如CQ溢出时)返回NULL
+    io_uring_sqe *get_sqe();
+
+    // 提交所有SQE并至少等待wait_nr个CQE
+    int submit_and_wait(unsigned wait_nr);
+
+    // 遍历CQ: peek_cqe为NULL表示当前没有完成事件
+    io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+    // 各种操作的准备函数, 没有空闲的SQE时返回false, 由调用者收割完成事件后重试或关闭连接
+    bool prep_accept_multishot(int fd, uint64_t user_data);
+    bool prep_recv_multishot(int fd, unsigned short bgid, uint64_t user_data);
+    bool prep_writev(int fd, const struct iovec *iov, int iov_count, uint64_t user_data);
+    bool prep_poll_multishot(int fd, unsigned poll_mask, uint64_t user_data);
+
+private:
+    int m_ring_fd;
+
+    // SQ
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    io_uring_sqe *m_sqes;
+    unsigned m_sqe_tail;    // 本地已填好但还没发布给内核的SQE位置
+    unsigned m_sqe_head;
+
+    // CQ
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    io_uring_cqe *m_cqes;
+
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    size_t m_sqes_size;
+
+    // 提供缓冲区环
+    io_uring_buf_ring *m_buf_ring;
+    size_t m_buf_ring_size;
+    char *m_bufs;
+    unsigned m_buf_size;
+    unsigned m_buf_entries;
+    unsigned short m_buf_tail;
+
+    int flush_sq();
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "config.h"
+
+Config::Config()
+{
+    // 端口号, 默认9006
+    PORT = 9006;
+
+    // 日志写入方式, 默认同步
+    LOGWrite = 0;
+
+    // 触发组合模式, 默认listenfd LT + connfd LT
+    TRIGMode = 0;
+
+    // listenfd触发模式, 默认LT
+    LISTENTrigmode = 0;
+
+    // connfd触发模式, 默认LT
+    CONNTrigmode = 0;
+
+    // 优雅关闭链接, 默认不使用
+    OPT_LINGER = 0;
+
+    // 数据库连接池数量, 默认8
+    sql_num = 8;
+
+    // 线程池内的线程数量, 默认8
+    thread_num = 8;
+
+    // 关闭日志, 默认不关闭
+    close_log = 0;
+
+    // 并发模型, 默认是proactor
+    actor_model = 0;
+
+    // 子Reactor数量, 默认每个核一个
+    reactor_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (reactor_num <= 0)
+        reactor_num = 1;
+
+    // I/O后端, 默认epoll
+    io_backend = 0;
+
+    // 线程池调度, 默认全局请求队列
+    work_steal = 0;
+
+    // 静态文件缓存, 默认64MB
+    file_cache_mb = 64;
+
+    // 静态文件缓存的文件数, 默认256
+    file_cache_num = 256;
+
+    // 每次可写事件的发送配额, 默认256KB
+    send_budget = 256;
+
+    // 小文件响应缓存, 默认8MB
+    resp_cache_mb = 8;
+
+    // 预压缩, 默认不生成
+    precompress = 0;
+
+    // 读缓冲上限, 默认64KB
+    max_read_buf = 64;
+
+    // 写缓冲上限, 默认16KB
+    max_write_buf = 16;
+}
+
+void Config::parse_arg(int argc, char *argv[])
+{
+    int opt;
+    const char *str = "p:l:m:o:s:t:c:a:r:u:w:f:n:b:e:z:i:x:";
+    while ((opt = getopt(argc, argv, str)) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+        {
+            PORT = atoi(optarg);
+            break;
+        }
+        case 'l':
+        {
+            LOGWrite = atoi(optarg);
+            break;
+        }
+        case 'm':
+        {
+            TRIGMode = atoi(optarg);
+            break;
+        }
+        case 'o':
+        {
+            OPT_LINGER = atoi(optarg);
+            break;
+        }
+        case 's':
+        {
+            sql_num = atoi(optarg);
+            break;
+        }
+        case 't':
+        {
+            thread_num = atoi(optarg);
+            break;
+        }
+        case 'c':
+        {
+            close_log = atoi(optarg);
+            break;
+        }
+        case 'a':
+        {
+            actor_model = atoi(optarg);
+            break;
+        }
+        case 'r':
+        {
+            reactor_num = atoi(optarg);
+            break;
+        }
+        case 'u':
+        {
+            io_backend = atoi(optarg);
+            break;
+        }
+        case 'w':
+        {
+            work_steal = atoi(optarg);
+            break;
+        }
+        case 'f':
+        {
+            file_cache_mb = atoi(optarg);
+            break;
+        }
+        case 'n':
+        {
+            file_cache_num = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            send_budget = atoi(optarg);
+            break;
+        }
+        case 'e':
+        {
+            resp_cache_mb = atoi(optarg);
+            break;
+        }
+        case 'z':
+        {
+            precompress = atoi(optarg);
+            break;
+        }
+        case 'i':
+        {
+            max_read_buf = atoi(optarg);
+            break;
+        }
+        case 'x':
+        {
+            max_write_buf = atoi(optarg);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
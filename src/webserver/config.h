@@ -40,8 +40,38 @@ public:
     //是否关闭日志
     int close_log;
 
-    //并发模型选择
+    //并发模型选择: 0 Proactor, 1 Reactor, 2 多Reactor
     int actor_model;
+
+    //多Reactor模式下的事件循环数量
+    int reactor_num;
+
+    //I/O后端: 0 epoll, 1 io_uring
+    int io_backend;
+
+    //线程池调度: 0 全局请求队列, 1 工作窃取
+    int work_steal;
+
+    //静态文件缓存的内存预算(MB), 0 不缓存
+    int file_cache_mb;
+
+    //静态文件缓存的文件数上限
+    int file_cache_num;
+
+    //每次可写事件每个连接最多发送的数据量(KB), 0 不限制
+    int send_budget;
+
+    //小文件完整响应缓存的内存上限(MB), 0 不缓存
+    int resp_cache_mb;
+
+    //启动时是否在后台为文本文件生成预压缩版本, 0 不生成
+    int precompress;
+
+    //每个连接读缓冲的上限(KB), 请求头和请求体超过时关闭连接
+    int max_read_buf;
+
+    //每个连接写缓冲的上限(KB)
+    int max_write_buf;
 };
 
 
@@ -0,0 +1,86 @@
+#include "conn_slab.h"
+
+conn_slab::conn_slab()
+{
+    m_max_fd = 0;
+    m_pages = NULL;
+    m_free = NULL;
+    m_live = 0;
+    m_allocated = 0;
+    m_gen = 0;
+}
+
+// 与文件缓存一样, 进程退出时交给系统回收; 工作线程可能还引用着连接对象
+conn_slab::~conn_slab()
+{
+}
+
+void conn_slab::init(int max_fd)
+{
+    m_max_fd = max_fd;
+    int pages = (max_fd + PAGE_SIZE - 1) / PAGE_SIZE;
+    m_pages = new conn_slot **[pages];
+    for (int i = 0; i < pages; i++)
+        m_pages[i] = NULL;
+}
+
+conn_slot *conn_slab::alloc(int fd)
+{
+    if (fd < 0 || fd >= m_max_fd)
+        return NULL;
+
+    m_lock.lock();
+    conn_slot **&page = m_pages[fd >> PAGE_BITS];
+    if (!page)
+    {
+        page = new conn_slot *[PAGE_SIZE];
+        for (int i = 0; i < PAGE_SIZE; i++)
+            page[i] = NULL;
+    }
+
+    // 连接状态在socket关闭之前归还, fd对应的位置应当是空的
+    conn_slot *&entry = page[fd & (PAGE_SIZE - 1)];
+    if (entry)
+    {
+        m_lock.unlock();
+        return NULL;
+    }
+
+    if (!m_free)
+    {
+        conn_slot *slab = new conn_slot[SLAB_SIZE];
+        m_slabs.push_back(slab);
+        for (int i = SLAB_SIZE - 1; i >= 0; i--)
+        {
+            slab[i].next_free = m_free;
+            m_free = slab + i;
+        }
+        m_allocated += SLAB_SIZE;
+    }
+
+    conn_slot *slot = m_free;
+    m_free = slot->next_free;
+    slot->next_free = NULL;
+    entry = slot;
+    m_live++;
+    m_lock.unlock();
+    return slot;
+}
+
+void conn_slab::free(int fd)
+{
+    conn_slot *slot = get(fd);
+    if (!slot)
+        return;
+
+    // 空闲的连接状态不占缓冲区, 也不让文件缓存项多留一个引用
+    slot->conn.close_conn();
+    string().swap(slot->uring.pending);
+
+    m_lock.lock();
+    m_pages[fd >> PAGE_BITS][fd & (PAGE_SIZE - 1)] = NULL;
+    slot->next_free = m_free;
+    m_free = slot;
+    m_live--;
+    m_lock.unlock();
+}
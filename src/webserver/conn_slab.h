@@ -0,0 +1,89 @@
+#ifndef CONN_SLAB_H
+#define CONN_SLAB_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include "../lock/locker.h"
+#include "../timer/lst_timer.h"
+#include "../httprequest/http_conn.h"
+
+using namespace std;
+
+// io_uring后端每个连接的状态
+struct uring_conn
+{
+    unsigned gen;       // 连接的代数, 进程内递增, 用来丢弃fd被复用前旧连接的完成事件
+    bool busy;          // 有writev在途或请求在线程池中处理, 这期间收到的数据先放在pending
+    string pending;
+};
+
+// 一个连接的全部状态, 在slab中整块分配.
+// 只有事件循环访问的定时器和io_uring状态放在前面, http_conn按缓存行对齐, 整个对象也按缓存行对齐,
+// 相邻连接不共享缓存行
+struct conn_slot
+{
+    client_data data;   // 定时器及连接资源
+    uring_conn uring;
+    conn_slot *next_free;
+    http_conn conn;
+};
+
+// 连接状态的slab分配器和按fd索引的连接表:
+// 连接状态在accept时从空闲链表取, 不够时一次向系统申请一个slab; 连接关闭且线程池、io_uring都不再引用时
+// 归还空闲链表(见http_conn::release), 内存不还给系统.
+// 连接表分两级, 第二级按页在第一次用到时分配, 内存随同时存在的连接数增长, 而不是按最大fd预留
+class conn_slab
+{
+public:
+    static const int SLAB_SIZE = 64;    // 每个slab的连接数
+    static const int PAGE_BITS = 8;     // 连接表每页256项
+    static const int PAGE_SIZE = 1 << PAGE_BITS;
+
+    // 单例
+    static conn_slab *get_instance()
+    {
+        static conn_slab instance;
+        return &instance;
+    }
+
+    // fd的上限, 只在启动时调用一次
+    void init(int max_fd);
+
+    // 为新连接取一个连接状态并登记到连接表, fd超出上限或还登记着连接时返回NULL
+    conn_slot *alloc(int fd);
+    // 连接的最后一个引用放掉时调用(http_conn::release), 之后才关闭socket:
+    // 从连接表中去掉, 释放连接引用的缓冲区和文件后归还空闲链表
+    void free(int fd);
+
+    // fd对应的连接状态, 没有连接时为NULL; 只有fd所属的事件循环会登记和去掉它, 查表不加锁
+    conn_slot *get(int fd)
+    {
+        if (fd < 0 || fd >= m_max_fd)
+            return NULL;
+        conn_slot **page = m_pages[fd >> PAGE_BITS];
+        return page ? page[fd & (PAGE_SIZE - 1)] : NULL;
+    }
+
+    // io_uring后端给新连接的代数
+    unsigned next_gen() { return ++m_gen; }
+
+    int live() { return m_live; }
+    int allocated() { return m_allocated; }
+
+private:
+    conn_slab();
+    ~conn_slab();
+
+private:
+    int m_max_fd;
+    conn_slot ***m_pages;       // 第一级, 每项指向一页conn_slot*
+    conn_slot *m_free;          // 空闲链表, 后进先出, 刚归还的对象还在缓存中
+    vector<conn_slot *> m_slabs;
+    std::atomic<int> m_live;        // 在用的连接状态数
+    std::atomic<int> m_allocated;   // 已分配的连接状态数
+    std::atomic<unsigned> m_gen;
+    locker m_lock;              // 多Reactor模式下各事件循环同时accept和关闭连接
+};
+
+#endif
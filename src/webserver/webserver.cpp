@@ -2,8 +2,8 @@
 
 WebServer::WebServer()
 {
-    // http连接对象数组
-    users = new http_conn[MAX_FD];
+    // 连接状态在accept时从slab分配
+    m_conns = conn_slab::get_instance();
 
     // /root路径
     char server_path[200];
@@ -13,24 +13,82 @@ WebServer::WebServer()
     strcpy(m_root, server_path);
     strcat(m_root, root);
 
-    // 定时器对象数组
-    users_timer = new client_data[MAX_FD];
+    m_listenfd = -1;
+    m_signalfd = -1;
+    m_stop_server = false;
+    m_last_stats = 0;
+    m_parent = NULL;
+    m_sub_reactors = NULL;
+    m_reactor_threads = NULL;
+    m_reactor_num = 0;
+    m_ring = NULL;
+    m_uring_rearm = 0;
+    m_uring_done = NULL;
+}
+
+// 子Reactor: fd在进程内唯一, 各个事件循环只访问自己accept到的fd, 因此共用按fd索引的连接表
+WebServer::WebServer(WebServer *parent)
+{
+    m_conns = parent->m_conns;
+    m_root = parent->m_root;
+    m_pool = parent->m_pool;
+    m_connPool = parent->m_connPool;
+
+    m_port = parent->m_port;
+    m_user = parent->m_user;
+    m_passWord = parent->m_passWord;
+    m_databaseName = parent->m_databaseName;
+    m_sql_num = parent->m_sql_num;
+    m_thread_num = parent->m_thread_num;
+    m_work_steal = parent->m_work_steal;
+    m_log_write = parent->m_log_write;
+    m_close_log = parent->m_close_log;
+    m_OPT_LINGER = parent->m_OPT_LINGER;
+    m_TRIGMode = parent->m_TRIGMode;
+    m_LISTENTrigmode = parent->m_LISTENTrigmode;
+    m_CONNTrigmode = parent->m_CONNTrigmode;
+    m_actormodel = 0;   // 子Reactor在自己的线程里做I/O, 线程池只负责处理报文
+    m_io_backend = parent->m_io_backend;
+
+    m_listenfd = -1;
+    m_signalfd = -1;
+    m_stop_server = false;
+    m_last_stats = 0;
+    m_parent = parent;
+    m_sub_reactors = NULL;
+    m_reactor_threads = NULL;
+    m_reactor_num = 0;
+    m_ring = NULL;
+    m_uring_rearm = 0;
+    m_uring_done = NULL;
 }
 
 WebServer::~WebServer()
 {
     close(m_epollfd);
-    close(m_listenfd);
-    close(m_pipefd[1]);
-    close(m_pipefd[0]);
-    delete[] users;
-    delete[] users_timer;
+    if (m_listenfd != -1)
+        close(m_listenfd);
+    if (utils.m_timerfd != -1)
+        close(utils.m_timerfd);
+    delete m_uring_done;
+    if (m_parent)   // 共享资源由主对象释放
+        return;
+
+    if (m_signalfd != -1)
+        close(m_signalfd);
+    for (int i = 0; m_sub_reactors && i < m_reactor_num; i++)
+        delete m_sub_reactors[i];
+    delete[] m_sub_reactors;
+    delete[] m_reactor_threads;
     delete m_pool;
 }
 
 void WebServer::init(int port, string user, string passWord, string databaseName,
                      int log_write, int opt_linger, int trigmode, int sql_num,
-                     int thread_num, int close_log, int actor_model)
+                     int thread_num, int close_log, int actor_model, int reactor_num,
+                     int io_backend, int work_steal, int file_cache_mb, int file_cache_num,
+                     int send_budget, int resp_cache_mb, int precompress,
+                     int max_read_buf, int max_write_buf)
 {
     m_port = port;
     m_user = user;
@@ -43,6 +101,33 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+    m_reactor_num = reactor_num;
+    m_io_backend = io_backend;
+    m_work_steal = work_steal;
+    m_file_cache_mb = file_cache_mb;
+    m_file_cache_num = file_cache_num;
+    m_resp_cache_mb = resp_cache_mb;
+    m_precompress = precompress;
+
+    // 连接表按最大fd分页, 页在第一次用到时分配
+    m_conns->init(MAX_FD);
+
+    // 所有连接相同的配置; 当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
+    http_conn::doc_root = m_root;
+    http_conn::m_close_log = m_close_log;
+
+    // 所有连接共用的发送配额
+    http_conn::m_send_budget = (long long)send_budget << 10;
+
+    // 连接缓冲的上限, 至少要放得下初始大小
+    http_conn::m_max_read_buf = max(max_read_buf << 10, (int)http_conn::READ_BUFFER_INIT);
+    http_conn::m_max_write_buf = max(max_write_buf << 10, (int)http_conn::WRITE_BUFFER_INIT);
+
+    // SIGTERM由事件循环通过signalfd读取, 要在创建日志、线程池等线程之前屏蔽, 新线程继承屏蔽字
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
 }
 
 //  epoll触发模式
@@ -68,6 +153,8 @@ void WebServer::trig_mode()
         m_LISTENTrigmode = 1;
         m_CONNTrigmode = 1;
     }
+
+    http_conn::m_TRIGMode = m_CONNTrigmode;
 }
 
 // 日志
@@ -91,32 +178,47 @@ void WebServer::sql_pool()
     m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
 
     //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+    http_conn::initmysql_result(m_connPool);
+}
+
+// 静态文件缓存
+void WebServer::file_pool()
+{
+    // io_uring后端从内存提交writev, 文件都要映射; epoll后端大文件用sendfile
+    size_t map_limit = m_io_backend == 1 ? 0 : http_conn::SENDFILE_THRESHOLD;
+    file_cache::get_instance()->init((size_t)m_file_cache_mb << 20, m_file_cache_num, map_limit, m_close_log);
+
+    // 完整响应缓存依赖文件缓存判断文件是否变化
+    response_cache::get_instance()->init(m_file_cache_mb > 0 ? (size_t)m_resp_cache_mb << 20 : 0);
+
+    // 后台生成预压缩版本, 生成之前的请求发送原文件
+    if (m_precompress)
+        precompress::start(m_root, m_close_log);
 }
 
 // 线程池
 void WebServer::thread_pool()
 {
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_thread_num, 10000, m_work_steal);
 }
 
-// 创建listenfd, 启动监听, 以及其他相关设置
-void WebServer::eventListen()
+// 创建监听socket; 多Reactor模式下每个事件循环各自bind同一个端口, 由内核按SO_REUSEPORT分发新连接
+int WebServer::listen_socket(bool reuse_port)
 {
     // 创建监听fd
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd>=0);
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(listenfd>=0);
 
     // SO_LINGER 优雅关闭连接
     if( m_OPT_LINGER == 0)
     {
         struct linger tmp = {0,1};
-        setsockopt(m_listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
+        setsockopt(listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
     }
     else if( m_OPT_LINGER == 1)
     {
         struct linger tmp = {1,1};
-        setsockopt(m_listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
+        setsockopt(listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
     }
 
     int ret = 0;
@@ -129,70 +231,152 @@ void WebServer::eventListen()
     // SO_REUSEADDR 端口复用? SO_REUSEADDR是一个很有用的选项，一般服务器的监听socket都应该打开它。
     // 它的大意是允许服务器bind一个地址，即使这个地址当前已经存在已建立的连接
     int flag = 1;
-    setsockopt(m_listenfd,SOL_SOCKET,SO_REUSEADDR,&flag,sizeof(flag));
+    setsockopt(listenfd,SOL_SOCKET,SO_REUSEADDR,&flag,sizeof(flag));
+    // SO_REUSEPORT 允许多个socket bind同一端口, 内核把新连接均匀分给它们
+    if (reuse_port)
+        setsockopt(listenfd,SOL_SOCKET,SO_REUSEPORT,&flag,sizeof(flag));
 
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret>=0);
-    ret = listen(m_listenfd,5);
+    ret = listen(listenfd,5);
     assert(ret>=0);
 
+    return listenfd;
+}
+
+// 创建listenfd, 启动监听, 以及其他相关设置
+void WebServer::eventListen()
+{
     // 工具对象
     utils.init(TIMESLOT);
 
     // epoll事件表
-    epoll_event events[MAX_EVENT_NUMBER];
     m_epollfd = epoll_create(5);
     assert(m_epollfd!=-1);
-    // 为监听socket注册epoll读事件
-    utils.addfd(m_epollfd,m_listenfd,false,m_LISTENTrigmode);   // 只用在主线程的socket不需要one_shot
-    http_conn::m_epollfd = m_epollfd;
-    
-    // 创建管道, 并注册epoll读事件
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
+
+    // 多Reactor模式下主线程只处理信号, 监听socket交给各个子Reactor
+    if (m_actormodel != 2)
+    {
+        m_listenfd = listen_socket(false);
+        // 为监听socket注册epoll读事件
+        utils.addfd(m_epollfd,m_listenfd,false,m_LISTENTrigmode);   // 只用在主线程的socket不需要one_shot
+    }
+
+    // 定时器: timerfd按时间轮的下一个到期时间到期
+    int ret = utils.init_timerfd();
     assert(ret!=-1);
-    utils.setnonblocking(m_pipefd[1]);                          // 非阻塞的写端, alarm的定时事件就是往管道里面写入时钟信号或者异常信号
-    utils.addfd(m_epollfd,m_pipefd[0],false,0);                 // 只用在主线程的socket不需要one_shot
+    utils.addfd(m_epollfd,utils.m_timerfd,false,0);             // 只用在主线程的fd不需要one_shot
+
+    // 信号: SIGTERM已在init中屏蔽, 通过signalfd在事件循环中同步处理
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    m_signalfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(m_signalfd!=-1);
+    utils.addfd(m_epollfd,m_signalfd,false,0);
 
     // 注册信号处理函数
     utils.addsig(SIGPIPE, SIG_IGN);         // 对端connfd关闭后, 再往里面写会产生的信号, 默认行为是终止程序; SIG_IGN 表示交给系统处理
-    utils.addsig(SIGALRM, utils.sig_handler, false);    // 时钟信号
-    utils.addsig(SIGTERM, utils.sig_handler, false);    // kill
 
-    // 开启定时信号
-    alarm(TIMESLOT);
+    // Reactor模式下注册线程池的完成通知
+    if (m_actormodel == 1)
+        utils.addfd(m_epollfd, m_pool->done_fd(), false, 0);
 
-    Utils::u_epollfd = m_epollfd;
-    Utils::u_pipefd = m_pipefd;
+    if (m_actormodel == 2)
+        sub_reactor();
 }
 
-// 初始化http连接对象的同时设置定时器
-void WebServer::timer(int connfd, struct sockaddr_in client_address)
+// 创建并启动子Reactor, 每个子Reactor有自己的监听socket、epoll、时间轮和线程
+void WebServer::sub_reactor()
 {
+    if (m_reactor_num <= 0)
+        m_reactor_num = 1;
+
+    m_sub_reactors = new WebServer *[m_reactor_num];
+    m_reactor_threads = new pthread_t[m_reactor_num];
+
+    // 子线程屏蔽所有信号, 信号统一由主线程通过signalfd处理
+    sigset_t mask, old_mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+
+    for (int i = 0; i < m_reactor_num; i++)
+    {
+        WebServer *sub = new WebServer(this);
+        sub->utils.init(TIMESLOT);
+        sub->m_epollfd = epoll_create(5);
+        assert(sub->m_epollfd != -1);
+        sub->m_listenfd = sub->listen_socket(true);
+        sub->utils.addfd(sub->m_epollfd, sub->m_listenfd, false, m_LISTENTrigmode);
+        int ret = sub->utils.init_timerfd();
+        assert(ret != -1);
+        sub->utils.addfd(sub->m_epollfd, sub->utils.m_timerfd, false, 0);
+
+        m_sub_reactors[i] = sub;
+        if (pthread_create(m_reactor_threads + i, NULL, reactor_worker, sub) != 0)
+            throw std::exception();
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+// 主线程退出前通知子Reactor: 置退出标志后让各自的timerfd立即到期, 再等待线程结束
+void WebServer::stop_sub_reactor()
+{
+    m_stop_server = true;
+    for (int i = 0; m_sub_reactors && i < m_reactor_num; i++)
+        m_sub_reactors[i]->utils.wakeup_timerfd();
+    for (int i = 0; m_reactor_threads && i < m_reactor_num; i++)
+        pthread_join(m_reactor_threads[i], NULL);
+}
+
+void *WebServer::reactor_worker(void *arg)
+{
+    WebServer *sub = (WebServer *)arg;
+    sub->eventLoop();
+    return sub;
+}
+
+// 为新连接分配连接状态, 初始化http连接对象的同时设置定时器; fd超出连接表时关闭连接并返回NULL
+conn_slot *WebServer::timer(int connfd, struct sockaddr_in client_address)
+{
+    conn_slot *slot = m_conns->alloc(connfd);
+    if (!slot)
+    {
+        utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        return NULL;
+    }
+
+    // io_uring驱动的连接不注册epoll
+    int epollfd = m_ring ? -1 : m_epollfd;
+
     // 初始化http连接对象
-    users[connfd].init(connfd,client_address, m_root, m_CONNTrigmode, m_close_log,m_user,m_passWord,m_databaseName);
+    slot->conn.init(connfd, client_address, epollfd);
 
     // 初始化定时器,包括conn数据,回调函数和超时时间
-    users_timer[connfd].address = client_address;
-    users_timer[connfd].sockfd = connfd;
-    util_timer *timer = new util_timer;
-    timer->user_data = &users_timer[connfd];
+    client_data *data = &slot->data;
+    data->address = client_address;
+    data->sockfd = connfd;
+    data->epollfd = epollfd;
+    util_timer *timer = &data->timer_node;
+    timer->user_data = data;
     timer->cb_func = cb_func;
-    time_t cur = time(NULL);
-    timer->expire = cur + 3*TIMESLOT;
-    users_timer[connfd].timer = timer;
-    // 将定时器加入链表
-    utils.m_timer_lst.add_timer(timer);
+    timer->expire = get_time_ms() + CONN_TIMEOUT;
+    data->timer = timer;
+    // 将定时器加入时间轮, 必要时提前timerfd
+    utils.m_time_wheel.add_timer(timer);
+    utils.update_timerfd();
+    return slot;
 }
 
-// 调整定时器, 计时往后延3个单位; 并调整定时器在链表中的位置
+// 调整定时器, 计时往后延CONN_TIMEOUT; 并调整定时器在时间轮中的位置
 void WebServer::adjust_timer(util_timer *timer)
 {
-    time_t cur = time(NULL);
-
-    // 定时时间重置为 cur + 3*TIMESLOT
-    timer->expire = cur +3*TIMESLOT;
-    // 调整链表
-    utils.m_timer_lst.add_timer(timer);
+    // 定时时间重置为 当前时间 + CONN_TIMEOUT, 只会往后延, 不用改timerfd
+    timer->expire = get_time_ms() + CONN_TIMEOUT;
+    // 重新放置 (定时器已在时间轮中, 不能再add_timer)
+    utils.m_time_wheel.adjust_timer(timer);
 
     LOG_INFO("%s", "adjust timer once");
 }
@@ -200,14 +384,16 @@ void WebServer::adjust_timer(util_timer *timer)
 // 主线程处理 定时器超时 事件
 void WebServer::deal_timer(util_timer *timer, int sockfd)
 {
-    // 删除connfd的epoll事件并close关闭connfd连接
-    timer->cb_func(&users_timer[sockfd]);
-    if(timer)
-    {   // 释放timer并调整链表
-        utils.m_timer_lst.del_timer(timer);
-    }
+    // 定时器已经被删除(连接已超时关闭)
+    if (!timer)
+        return;
 
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);   
+    // 从时间轮中取下timer
+    utils.m_time_wheel.del_timer(timer);
+    // 删除connfd的epoll事件并close关闭connfd连接, 连接状态随之归还slab
+    timer->cb_func(timer->user_data);
+
+    LOG_INFO("close fd %d", sockfd);
 }
 
 // 主线程处理listenfd读事件
@@ -261,36 +447,24 @@ bool WebServer::dealclinetdata()
     return true;
 }
 
-// 主线程处理管道传来的信号
-bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
+// 主线程处理signalfd中的信号
+bool WebServer::dealwithsignal(bool &stop_server)
 {
-    int ret = 0;
-    int sig;
-    char signals[1024]; // 管道中的数据, 这里一般是信号值
-    ret = recv(m_pipefd[0],signals, sizeof(signals), 0);    
-    if (ret == -1)
+    struct signalfd_siginfo signals[16];
+    int ret = read(m_signalfd, signals, sizeof(signals));
+    if (ret <= 0)
     {
         return false;
     }
-    else if (ret == 0)
-    {
-        return false;
-    }
-    else
+
+    for (int i = 0; i < ret / (int)sizeof(signals[0]); i++)
     {
-        for(int i=0;i<ret;i++)
+        switch (signals[i].ssi_signo)
         {
-            switch (signals[i]) // char
-            {   //      int
-                case SIGALRM:       // 发生定时事件 (alarm的SIGALRM信号注册的回调函数是 sig_handler ,里面是给管道的写端 send(pipefd[1], 信号值))
-                {
-                    timeout = true; // 发生定时事件
-                    break;
-                }
-                case SIGTERM:       // 程序终止信号
-                {
-                    stop_server = true; // 关闭服务器
-                }
+            case SIGTERM:       // 程序终止信号
+            {
+                stop_server = true; // 关闭服务器
+                break;
             }
         }
     }
@@ -300,8 +474,14 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
 // 主线程处理 connfd 读事件
 void WebServer::dealwithread(int sockfd)
 {
+    // 同一批事件中前面的事件可能已经关闭了这个连接; 已关闭的连接在工作线程放掉引用之前还在连接表中, 定时器为NULL
+    conn_slot *slot = m_conns->get(sockfd);
+    if (!slot || !slot->data.timer)
+        return;
+    http_conn *conn = &slot->conn;
+
     // 可能需要重置该connfd对应的定时器
-    util_timer *timer = users_timer[sockfd].timer;
+    util_timer *timer = slot->data.timer;
 
     // reactor  主线程不需要做I/O工作,只是往线程池的请求队列里面添加一个请求,由子线程竞争获取请求后做I/O操作
     if(m_actormodel == 1)
@@ -310,41 +490,26 @@ void WebServer::dealwithread(int sockfd)
         {   // 更新定时器
             adjust_timer(timer);
         }
-        // 添加请求
-        m_pool->append(users+sockfd, 0);
-
-        // 这素?
-        while(true)
-        {
-            if(users[sockfd].improv == 1)
-            {
-                if(users[sockfd].timer_flag == 1)
-                {
-                    // 关闭连接
-                    deal_timer(timer,sockfd);
-                    users[sockfd].timer_flag = 0 ;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
-        }
+        // 添加请求, 不等待处理结果, 由完成队列通知主线程
+        m_pool->append(conn, 0);
     }
     // 模拟Procator  主线程需要做I/O工作,准备好数据之后,往线程池的请求队列里面添加一个请求,由子线程竞争获取请求后对数据进行加工处理
     else
     {
         // 成功读到数据
-        if(users[sockfd].read_once())
+        if(conn->read_once())
         {
             if(timer)
             {   // 更新定时器
                 adjust_timer(timer);
             }
 
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("deal with the client(%s)", inet_ntoa(conn->get_address()->sin_addr));
 
-            m_pool->append(users+sockfd, 0);
+            m_pool->append_p(conn);   // 数据已读好, 按请求分到对应通道
         }
         // 读取失败, 删除epoll事件, 关闭连接
+        else
         {
             deal_timer(timer,sockfd);
         }
@@ -355,8 +520,13 @@ void WebServer::dealwithread(int sockfd)
 // 子线程生成响应报文并设置好缓冲区数据后(process_read), 注册epoll写事件, 待下一步将数据搬到socket缓冲区发送(Reactor子线程来搬, Proacotr主线程来搬) 
 void WebServer::dealwithwrite(int sockfd)
 {
+    conn_slot *slot = m_conns->get(sockfd);
+    if (!slot || !slot->data.timer)
+        return;
+    http_conn *conn = &slot->conn;
+
     // 可能需要更新定时器, 或销毁定时器
-    util_timer *timer = users_timer[sockfd].timer;
+    util_timer *timer = slot->data.timer;
 
     // Reactor
     if (m_actormodel == 1)
@@ -366,33 +536,24 @@ void WebServer::dealwithwrite(int sockfd)
             adjust_timer(timer);
         }
 
-        m_pool->append(users + sockfd, 1);
-
-        while (true)
-        {
-            if (1 == users[sockfd].improv)
-            {
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
-        }
+        m_pool->append(conn, 1);
     }
     // Proactor
     else
     {
-        if (users[sockfd].write())
+        bool pipelined;
+        if (conn->write(&pipelined))
         {
             if (timer)
             {
                 adjust_timer(timer);
             }
             
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("send data to the client(%s)", inet_ntoa(conn->get_address()->sin_addr));
+
+            // 流水线: 读缓冲中已有后续请求, 和读到数据一样交给线程池
+            if (pipelined)
+                m_pool->append_p(conn);
         }
         else
         {
@@ -402,15 +563,71 @@ void WebServer::dealwithwrite(int sockfd)
 }
 
 
-// 服务器主线程的事件循环
+// Reactor模式下处理工作线程的完成通知, 读写失败的连接在这里关闭
+void WebServer::dealwithdone()
+{
+    m_pool->pop_done(m_done);
+
+    for (size_t i = 0; i < m_done.size(); i++)
+    {
+        http_conn *request = m_done[i];
+        if (request->timer_flag == 1)
+        {
+            request->timer_flag = 0;
+            int sockfd = request->get_sockfd();
+            conn_slot *slot = m_conns->get(sockfd);
+            if (slot && &slot->conn == request)
+                deal_timer(slot->data.timer, sockfd);
+        }
+    }
+}
+
+// 每隔STATS_INTERVAL把线程池各通道的排队深度和延迟、响应缓存的命中情况、连接状态的数量写入日志; 多Reactor模式下由先到的事件循环输出
+void WebServer::log_stats()
+{
+    if (m_close_log || !m_pool)
+        return;
+
+    WebServer *owner = m_parent ? m_parent : this;
+    long long now = get_time_ms();
+    long long last = owner->m_last_stats;
+    if (now - last < STATS_INTERVAL || !owner->m_last_stats.compare_exchange_strong(last, now))
+        return;
+
+    static const char *names[http_conn::LANE_NUM] = {"static", "cgi", "write"};
+    for (int lane = 0; lane < http_conn::LANE_NUM; lane++)
+    {
+        lane_stats st;
+        m_pool->get_lane_stats(lane, st);
+        LOG_INFO("lane %s: workers %d, depth %ld (max %ld), tasks %ld, wait avg %ldus max %ldus, service avg %ldus",
+                 names[lane], st.workers, st.depth, st.max_depth, st.tasks, st.avg_wait, st.max_wait, st.avg_service);
+    }
+
+    response_cache::stats rs;
+    response_cache::get_instance()->get_stats(rs);
+    LOG_INFO("response cache: hits %ld, misses %ld, entries %ld, bytes %zu",
+             rs.hits, rs.misses, rs.entries, rs.bytes);
+
+    LOG_INFO("connections: live %d, allocated %d", m_conns->live(), m_conns->allocated());
+}
+
+// 服务器主线程的事件循环; 多Reactor模式下每个子Reactor线程也运行这个循环
 void WebServer::eventLoop()
 {
+    // io_uring后端, 创建ring失败时退回epoll
+    if (m_io_backend == 1)
+    {
+        if (uringLoop())
+            return;
+        LOG_ERROR("%s", "io_uring unavailable, fall back to epoll");
+    }
+
     bool timeout = false;       // 超时事件
     bool stop_server = false;   // 服务器停止运行
 
     while(!stop_server)
     {
-        // 获取epoll事件
+        // 获取epoll事件, 定时器由timerfd唤醒, 不需要超时
         int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
         if(number<0 && errno != EINTR)  // 若epoll_wait阻塞过程中被中断, 中断结束后不再阻塞, 返回 -1 和errno EINTR
         {
@@ -429,14 +646,23 @@ void WebServer::eventLoop()
                 if (false == flag)
                     continue;
             }
+            else if (m_actormodel == 1 && sockfd == m_pool->done_fd())  // 工作线程的完成通知
+            {
+                dealwithdone();
+            }
             else if(events[i].events & (EPOLLRDHUP|EPOLLHUP|EPOLLERR))  // EPOLLRDHUP 和 EPOLLHUP 是socket关闭事件, 
             {
-                util_timer *timer = users_timer[sockfd].timer;
-                deal_timer(timer,sockfd);
+                conn_slot *slot = m_conns->get(sockfd);
+                if (slot)
+                    deal_timer(slot->data.timer, sockfd);
             }
-            else if((sockfd == m_pipefd[0])&&(events[i].events & EPOLLIN))  // 处理管道中的信号
+            else if (sockfd == utils.m_timerfd)     // timerfd到期
             {
-                bool flag = dealwithsignal(timeout, stop_server);
+                timeout = true;
+            }
+            else if (sockfd == m_signalfd)          // 处理signalfd中的信号
+            {
+                bool flag = dealwithsignal(stop_server);
                 if(flag==false)
                     LOG_ERROR("%s", "deal signal failure");
             }
@@ -450,7 +676,13 @@ void WebServer::eventLoop()
             }
         }
 
-        // 处理定时器为非必须事件，收到信号并不是立马处理
+        // 子Reactor: 主线程收到SIGTERM后跟随退出(主线程通过timerfd唤醒子Reactor)
+        if (m_parent && m_parent->m_stop_server)
+            break;
+
+        log_stats();
+
+        // 处理定时器为非必须事件，timerfd到期并不是立马处理
         // 处理完epoll监听的socket事件之后, 再根据timeout值,判断是否有超时的连接需要关闭
         if(timeout)
         {
@@ -461,6 +693,409 @@ void WebServer::eventLoop()
             timeout = false;
         }
     }
+
+    stop_sub_reactor();
+}
+
+
+/* =============== io_uring后端 ================ */
+
+// user_data编码: 高8位操作类型, 中间24位fd的代数, 低32位fd
+enum URING_OP { URING_ACCEPT = 0, URING_RECV, URING_WRITE, URING_SIGNAL, URING_TICK, URING_DONE };
+
+static inline uint64_t uring_data(int op, unsigned gen, int fd)
+{
+    return ((uint64_t)op << 56) | ((uint64_t)(gen & 0xffffff) << 32) | (uint32_t)fd;
+}
+
+// io_uring事件循环: 多路accept、多路recv(内核从提供缓冲区环里取缓冲区)、writev都只在提交时进一次内核,
+// 一次io_uring_enter既提交新的请求又收割完成事件. 报文仍由http_conn的状态机解析和生成, 静态请求在本线程内处理,
+// 要访问数据库的请求交给线程池, 处理完经本事件循环的完成队列回到本线程
+bool WebServer::uringLoop()
+{
+    uring ring;
+    if (!ring.init(URING_ENTRIES) || !ring.setup_buf_ring(URING_BGID, URING_BUF_NUM, URING_BUF_SIZE))
+        return false;
+
+    m_ring = &ring;
+    // 工作线程可能在事件循环退出后才放入完成事件, 完成队列随WebServer对象释放
+    if (!m_uring_done)
+        m_uring_done = new done_queue<http_conn>();
+
+    // 多Reactor模式下主线程没有监听socket
+    if (m_listenfd != -1)
+        uring_arm(URING_ACCEPT);
+    if (m_signalfd != -1)
+        uring_arm(URING_SIGNAL);
+    // 定时器和子Reactor的退出检查由timerfd驱动, 和epoll后端一样
+    uring_arm(URING_TICK);
+    uring_arm(URING_DONE);
+
+    bool timeout = false;
+    bool stop_server = false;
+    while (!stop_server)
+    {
+        int ret = ring.submit_and_wait(1);
+        if (ret < 0 && errno != EINTR)
+        {
+            LOG_ERROR("%s", "io_uring_enter failure");
+            break;
+        }
+
+        io_uring_cqe *cqe;
+        while ((cqe = ring.peek_cqe()) != NULL)
+        {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            ring.cqe_seen();
+
+            int op = data >> 56;
+            unsigned gen = (data >> 32) & 0xffffff;
+            int fd = (int)(uint32_t)data;
+
+            switch (op)
+            {
+            case URING_ACCEPT:
+                uring_accept(res, flags);
+                break;
+            case URING_RECV:
+                uring_read(fd, gen, res, flags);
+                break;
+            case URING_WRITE:
+                uring_write(fd, gen, res);
+                break;
+            case URING_SIGNAL:
+            {
+                if (!dealwithsignal(stop_server))
+                    LOG_ERROR("%s", "deal signal failure");
+                if (!(flags & IORING_CQE_F_MORE))
+                    uring_arm(URING_SIGNAL);
+                break;
+            }
+            case URING_TICK:
+            {
+                timeout = true;
+                if (!(flags & IORING_CQE_F_MORE))
+                    uring_arm(URING_TICK);
+                break;
+            }
+            case URING_DONE:
+            {
+                uring_done();
+                if (!(flags & IORING_CQE_F_MORE))
+                    uring_arm(URING_DONE);
+                break;
+            }
+            }
+        }
+
+        // SQ满时没能提交的多路操作, CQ已收割, 重试
+        for (int op = URING_ACCEPT; m_uring_rearm && op <= URING_DONE; op++)
+        {
+            if (m_uring_rearm & (1u << op))
+                uring_arm(op);
+        }
+
+        if (m_parent && m_parent->m_stop_server)
+            break;
+
+        log_stats();
+
+        if (timeout)
+        {
+            utils.timer_handler();
+            LOG_INFO("%s", "timer tick");
+            timeout = false;
+        }
+    }
+
+    stop_sub_reactor();
+
+    m_ring = NULL;
+    return true;
+}
+
+// 提交监听socket、signalfd、timerfd、完成队列上的多路操作; 没有空闲的SQE时记下, 在下一轮收割完成事件后重试
+void WebServer::uring_arm(int op)
+{
+    bool ok = false;
+    switch (op)
+    {
+    case URING_ACCEPT:
+        ok = m_ring->prep_accept_multishot(m_listenfd, uring_data(URING_ACCEPT, 0, m_listenfd));
+        break;
+    case URING_SIGNAL:
+        ok = m_ring->prep_poll_multishot(m_signalfd, POLLIN, uring_data(URING_SIGNAL, 0, m_signalfd));
+        break;
+    case URING_TICK:
+        ok = m_ring->prep_poll_multishot(utils.m_timerfd, POLLIN, uring_data(URING_TICK, 0, utils.m_timerfd));
+        break;
+    case URING_DONE:
+        ok = m_ring->prep_poll_multishot(m_uring_done->fd(), POLLIN, uring_data(URING_DONE, 0, m_uring_done->fd()));
+        break;
+    }
+    if (ok)
+        m_uring_rearm &= ~(1u << op);
+    else
+        m_uring_rearm |= 1u << op;
+}
+
+// 提交连接的writev. 在途期间内核读取iovec指向的写缓冲和文件映射, writev持有连接的一个引用,
+// 连接在这期间关闭时, 连接状态等到完成事件到达才回收
+bool WebServer::uring_writev(conn_slot *slot, int sockfd)
+{
+    slot->conn.hold();
+    if (m_ring->prep_writev(sockfd, slot->conn.get_iv(), slot->conn.get_iv_count(),
+                            uring_data(URING_WRITE, slot->uring.gen, sockfd)))
+        return true;
+    slot->conn.release();   // 没有提交; 事件循环的引用还在, 不会回收
+    return false;
+}
+
+// 多路accept的完成事件, connfd为新连接或负的错误码
+void WebServer::uring_accept(int connfd, unsigned flags)
+{
+    // 多路accept被内核结束(出错等情况), 重新提交
+    if (!(flags & IORING_CQE_F_MORE))
+        uring_arm(URING_ACCEPT);
+
+    if (connfd < 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "acceept error", -connfd);
+        return;
+    }
+    if (http_conn::m_user_count >= MAX_FD)
+    {
+        utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        return;
+    }
+
+    // 多路accept不返回对端地址
+    struct sockaddr_in client_address;
+    memset(&client_address, 0, sizeof(client_address));
+    conn_slot *slot = timer(connfd, client_address);
+    if (!slot)
+        return;
+
+    uring_conn &conn = slot->uring;
+    conn.gen = m_conns->next_gen();
+    conn.busy = false;
+    conn.pending.clear();
+    // SQ满时关闭连接, 客户端可以重试
+    if (!m_ring->prep_recv_multishot(connfd, URING_BGID, uring_data(URING_RECV, conn.gen, connfd)))
+        uring_close(connfd);
+}
+
+// 多路recv的完成事件: 数据在内核选中的提供缓冲区里, 交给状态机后立刻归还
+void WebServer::uring_read(int sockfd, unsigned gen, int res, unsigned flags)
+{
+    conn_slot *slot = m_conns->get(sockfd);
+    char *buf = NULL;
+    unsigned short bid = 0;
+    if (flags & IORING_CQE_F_BUFFER)
+    {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        buf = m_ring->buf_addr(bid);
+    }
+
+    // 连接已关闭, 或fd已被复用, 这是旧连接的事件
+    if (!slot || !slot->data.timer || gen != (slot->uring.gen & 0xffffff))
+    {
+        if (buf)
+            m_ring->recycle_buf(bid);
+        return;
+    }
+    uring_conn &conn = slot->uring;
+
+    // 缓冲区暂时用完, 重新提交recv
+    if (res == -ENOBUFS)
+    {
+        if (!(flags & IORING_CQE_F_MORE) &&
+            !m_ring->prep_recv_multishot(sockfd, URING_BGID, uring_data(URING_RECV, conn.gen, sockfd)))
+            uring_close(sockfd);
+        return;
+    }
+
+    // 对端关闭或出错
+    if (res <= 0)
+    {
+        if (buf)
+            m_ring->recycle_buf(bid);
+        uring_close(sockfd);
+        return;
+    }
+
+    bool ok;
+    if (conn.busy)
+    {
+        conn.pending.append(buf, res);
+        ok = conn.pending.size() <= (size_t)http_conn::m_max_read_buf;
+    }
+    else
+        ok = slot->conn.read_from(buf, res);
+    m_ring->recycle_buf(bid);
+
+    if (!ok)
+    {
+        uring_close(sockfd);
+        return;
+    }
+
+    if (!(flags & IORING_CQE_F_MORE) &&
+        !m_ring->prep_recv_multishot(sockfd, URING_BGID, uring_data(URING_RECV, conn.gen, sockfd)))
+    {
+        uring_close(sockfd);
+        return;
+    }
+
+    adjust_timer(slot->data.timer);
+
+    if (!conn.busy)
+        uring_process(sockfd);
+}
+
+// writev的完成事件
+void WebServer::uring_write(int sockfd, unsigned gen, int res)
+{
+    // writev持有引用, 完成事件到达之前连接状态不会回收, fd也不会被复用
+    conn_slot *slot = m_conns->get(sockfd);
+    if (!slot || gen != (slot->uring.gen & 0xffffff))
+        return;
+    uring_conn &conn = slot->uring;
+
+    // 放掉writev的引用. 连接在writev在途时已关闭的, 由它回收连接状态, 之后不能再访问slot;
+    // 没关闭时事件循环的引用还在
+    bool closed = !slot->data.timer;
+    slot->conn.release();
+    if (closed)
+        return;
+
+    if (res < 0)
+    {
+        conn.busy = false;
+        uring_close(sockfd);
+        return;
+    }
+
+    int ret = slot->conn.write_uring(res);
+    if (ret == 1)   // 没写完, 接着发剩下的
+    {
+        if (!uring_writev(slot, sockfd))
+        {
+            conn.busy = false;
+            uring_close(sockfd);
+        }
+        return;
+    }
+
+    conn.busy = false;
+    if (ret < 0)    // 短连接
+    {
+        uring_close(sockfd);
+        return;
+    }
+
+    adjust_timer(slot->data.timer);
+
+    // 长连接: 发送期间收到的数据接在读缓冲中剩下的后续请求后面, 交给状态机
+    if (!uring_pending(slot))
+    {
+        uring_close(sockfd);
+        return;
+    }
+    if (slot->conn.buffered())
+        uring_process(sockfd);
+}
+
+// 运行状态机, 响应就绪后提交writev. 静态请求在本线程内处理; 登录、注册要等数据库, 交给线程池的CGI通道,
+// 处理完由完成队列通知本线程再提交writev, 不阻塞同一ring上的其他连接. 通道满时在本线程处理
+void WebServer::uring_process(int sockfd)
+{
+    conn_slot *slot = m_conns->get(sockfd);
+    if (slot->conn.classify() == http_conn::LANE_CGI)
+    {
+        slot->conn.m_done_queue = m_uring_done;
+        slot->uring.busy = true;
+        if (m_pool->append(&slot->conn, 3))
+            return;
+        slot->uring.busy = false;
+    }
+    uring_respond(slot, sockfd, slot->conn.process_uring());
+}
+
+// 状态机的结果: 0 请求不完整, 等待多路recv的下一批数据; 1 响应已就绪, 提交writev; -1 关闭连接
+void WebServer::uring_respond(conn_slot *slot, int sockfd, int ret)
+{
+    if (ret == 0)
+        return;
+    if (ret < 0)
+    {
+        uring_close(sockfd);
+        return;
+    }
+
+    uring_conn &conn = slot->uring;
+    conn.busy = true;
+    if (!uring_writev(slot, sockfd))
+    {
+        conn.busy = false;
+        uring_close(sockfd);
+    }
 }
 
+// 线程池处理完的请求, 每个都带着任务的引用
+void WebServer::uring_done()
+{
+    m_uring_done->pop(m_done);
 
+    for (size_t i = 0; i < m_done.size(); i++)
+    {
+        http_conn *request = m_done[i];
+        int sockfd = request->get_sockfd();
+        conn_slot *slot = m_conns->get(sockfd);
+
+        // 放掉任务的引用. 连接在处理期间已关闭的, 由它回收连接状态, 之后不能再访问;
+        // 没关闭时事件循环的引用还在
+        bool closed = !slot->data.timer;
+        int ret = request->m_result;
+        request->release();
+        if (closed)
+            continue;
+
+        slot->uring.busy = false;
+        if (ret != 0)
+        {
+            uring_respond(slot, sockfd, ret);
+            continue;
+        }
+
+        // 请求不完整: 处理期间收到了数据时接上, 再交给状态机
+        if (slot->uring.pending.empty())
+            continue;
+        if (!uring_pending(slot))
+            uring_close(sockfd);
+        else
+            uring_process(sockfd);
+    }
+}
+
+// 发送或处理期间收到的数据接在读缓冲后面; 超过读缓冲上限时返回false
+bool WebServer::uring_pending(conn_slot *slot)
+{
+    uring_conn &conn = slot->uring;
+    if (conn.pending.empty())
+        return true;
+    bool ok = slot->conn.read_from(conn.pending.data(), conn.pending.size());
+    conn.pending.clear();
+    return ok;
+}
+
+// 关闭连接; 挂着的多路recv会因为shutdown返回, 按代数或定时器判断后丢弃
+void WebServer::uring_close(int sockfd)
+{
+    conn_slot *slot = m_conns->get(sockfd);
+    if (slot)
+        deal_timer(slot->data.timer, sockfd);
+}
@@ -11,13 +11,28 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <atomic>
 
 #include "../threadpool/threadpool.h"
 #include "../httprequest/http_conn.h"
+#include "../uring/uring.h"
+#include "conn_slab.h"
 
 const int MAX_FD = 65536;
 const int MAX_EVENT_NUMBER = 10000;
 const int TIMESLOT = 5;
+const int CONN_TIMEOUT = 3 * TIMESLOT * 1000;   // 连接空闲超时(ms), timerfd按最早的超时时间触发, 可以小于1秒
+const int STATS_INTERVAL = TIMESLOT * 1000;      // 线程池通道、响应缓存统计写日志的间隔(ms)
+
+// io_uring后端参数
+const int URING_ENTRIES = 4096;     // SQ大小
+const int URING_BUF_NUM = 4096;     // 提供给多路recv的缓冲区数量, 必须是2的幂
+const int URING_BUF_SIZE = 2048;    // 每个缓冲区大小, 与http_conn的读缓冲一致
+const int URING_BGID = 0;           // 缓冲区组号
 
 class WebServer
 {
@@ -27,21 +42,48 @@ public:
 
     void init(int port, string user, string passWord, string databaseName,
               int log_write, int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model, int reactor_num,
+              int io_backend, int work_steal, int file_cache_mb, int file_cache_num,
+              int send_budget, int resp_cache_mb, int precompress,
+              int max_read_buf, int max_write_buf);
 
     void thread_pool();
     void sql_pool();
+    void file_pool();
     void log_write();
     void trig_mode();
     void eventListen();
     void eventLoop();
-    void timer(int connfd, struct sockaddr_in client_address);
+    conn_slot *timer(int connfd, struct sockaddr_in client_address);
     void adjust_timer(util_timer *timer);
     void deal_timer(util_timer*timer, int sockfd);
     bool dealclinetdata();
-    bool dealwithsignal(bool& timeout, bool& stop_server);
+    bool dealwithsignal(bool& stop_server);
     void dealwithread(int sockfd);
     void dealwithwrite(int sockfd);
+    void dealwithdone();
+    void log_stats();
+
+private:
+    // io_uring后端
+    bool uringLoop();
+    void uring_accept(int connfd, unsigned flags);
+    void uring_read(int sockfd, unsigned gen, int res, unsigned flags);
+    void uring_write(int sockfd, unsigned gen, int res);
+    void uring_process(int sockfd);
+    void uring_respond(conn_slot *slot, int sockfd, int ret);
+    void uring_done();
+    bool uring_pending(conn_slot *slot);
+    void uring_close(int sockfd);
+    void uring_arm(int op);
+    bool uring_writev(conn_slot *slot, int sockfd);
+
+    // 多Reactor模式: 每个子Reactor也是一个WebServer, 与主对象共享连接表和线程池
+    WebServer(WebServer *parent);
+    int listen_socket(bool reuse_port);
+    void sub_reactor();
+    void stop_sub_reactor();
+    static void *reactor_worker(void *arg);
 
 public:
 
@@ -51,10 +93,12 @@ public:
     int m_log_write;
     int m_close_log;
     int m_actormodel;
+    int m_io_backend;
+    std::atomic<bool> m_stop_server;   // 主线程退出时通知子Reactor
 
-    int m_pipefd[2];    // 用管道通信来处理信号
+    int m_signalfd;     // 用signalfd在事件循环里读取信号
     int m_epollfd;
-    http_conn *users;
+    conn_slab *m_conns;     // 连接状态, 按fd查找
 
     // 数据库相关
     connection_pool *m_connPool;
@@ -63,9 +107,18 @@ public:
     string m_databaseName; //使用数据库名
     int m_sql_num;
 
+    // 静态文件缓存相关
+    int m_file_cache_mb;    // 内存预算(MB), 0表示不缓存
+    int m_file_cache_num;   // 缓存的文件数上限, 每个文件占一个fd
+    int m_resp_cache_mb;    // 小文件完整响应缓存的内存上限(MB), 0表示不缓存
+    int m_precompress;      // 启动时是否生成预压缩版本
+
     // 线程池相关
     threadpool<http_conn> *m_pool;
     int m_thread_num;
+    int m_work_steal;                   // 线程池是否使用工作窃取调度
+    std::vector<http_conn *> m_done;    // 取出的完成队列, Reactor模式和io_uring后端共用
+    std::atomic<long long> m_last_stats;    // 上次输出统计的时间, 多Reactor模式下用主对象的
 
     //epoll_event相关
     epoll_event events[MAX_EVENT_NUMBER];
@@ -77,8 +130,18 @@ public:
     int m_CONNTrigmode;
 
     // 定时器相关
-    client_data *users_timer;
     Utils utils;
+
+    // 多Reactor相关
+    int m_reactor_num;
+    WebServer *m_parent;            // 子Reactor指向主对象, 主对象为NULL
+    WebServer **m_sub_reactors;     // 主对象持有的子Reactor
+    pthread_t *m_reactor_threads;
+
+    // io_uring相关, 只在事件循环运行期间有效
+    uring *m_ring;
+    unsigned m_uring_rearm;     // SQ满时没能提交的多路操作(第URING_OP位), 收割完成事件后重试
+    done_queue<http_conn> *m_uring_done;    // 本事件循环的完成队列, 线程池处理完的请求从这里回到本线程
 };
 
 #endif
\ No newline at end of file